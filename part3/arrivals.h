@@ -0,0 +1,184 @@
+#ifndef __ARRIVALS_H
+#define __ARRIVALS_H
+
+#include <math.h>
+#include <string.h>
+#include "elevator_uapi.h"
+
+/*
+ Passenger arrival models, shared by loadgen.c and sim/elevsim.c so both
+ replay the same traffic. An arrivals stream yields requests at a mean
+ rate (per minute) that varies over time according to the model:
+  - poisson: constant rate, start and destination uniform.
+  - bursty: a minute-long cycle of a 12 s burst at 4x the rate and 48 s
+    at a quarter of it, uniform floors.
+  - up-peak: constant rate, 80% of passengers start at the lobby.
+  - down-peak: constant rate, 80% of passengers head to the lobby.
+  - day: one day (day_ms long) of morning up-peak, quiet midday and
+    evening down-peak: 1.5x the rate for the first and last quarters
+    and half of it in between.
+ The mean over a whole cycle is the requested rate. Streams are fully
+ determined by their seed.
+*/
+
+enum arrival_model {
+	ARRIVAL_POISSON,
+	ARRIVAL_BURSTY,
+	ARRIVAL_UP_PEAK,
+	ARRIVAL_DOWN_PEAK,
+	ARRIVAL_DAY,
+};
+
+#define ARRIVAL_NUM_MODELS 5
+#define ARRIVAL_PEAK_PCT 80
+#define ARRIVAL_BURST_MS 12000.0
+#define ARRIVAL_CYCLE_MS 60000.0
+
+static const char *arrival_model_names[ARRIVAL_NUM_MODELS] = {
+	"poisson", "bursty", "up-peak", "down-peak", "day"
+};
+
+struct arrivals {
+	enum arrival_model model;
+	double rate; /* mean arrivals per minute */
+	double day_ms; /* length of a day for ARRIVAL_DAY */
+	int floors;
+	int type_weights[3]; /* relative odds of grape, sheep, wolf */
+	unsigned long long rng;
+	double now_ms; /* time of the last arrival */
+};
+
+/* the model called name, or -1 */
+static int arrival_model_parse(const char *name) {
+	int i;
+
+	for (i = 0; i < ARRIVAL_NUM_MODELS; ++i) {
+		if (strcmp(name, arrival_model_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void arrivals_init(struct arrivals *a, enum arrival_model model,
+double rate, int floors, unsigned long long seed) {
+	a->model = model;
+	a->rate = rate;
+	a->day_ms = 24 * 3600 * 1000.0;
+	a->floors = floors;
+	a->type_weights[0] = a->type_weights[1] = a->type_weights[2] = 1;
+	a->rng = seed;
+	a->now_ms = 0;
+}
+
+/* splitmix64, so runs are reproducible across libc versions */
+static unsigned long long arrival_rng(struct arrivals *a) {
+	unsigned long long z;
+
+	a->rng += 0x9e3779b97f4a7c15ULL;
+	z = a->rng;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static int arrival_rnd(struct arrivals *a, int min, int max) {
+	return arrival_rng(a) % (max - min + 1) + min;
+}
+
+/* uniform in (0, 1] */
+static double arrival_unit(struct arrivals *a) {
+	return ((arrival_rng(a) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/* rate multiplier at time ms, and its maximum over time */
+static double arrival_intensity(const struct arrivals *a, double ms) {
+	double phase;
+
+	switch (a->model) {
+	case ARRIVAL_BURSTY:
+		return fmod(ms, ARRIVAL_CYCLE_MS) < ARRIVAL_BURST_MS ? 4.0 : 0.25;
+	case ARRIVAL_DAY:
+		phase = fmod(ms, a->day_ms) / a->day_ms;
+		return phase < 0.25 || phase >= 0.75 ? 1.5 : 0.5;
+	default:
+		return 1.0;
+	}
+}
+
+static double arrival_max_intensity(const struct arrivals *a) {
+	switch (a->model) {
+	case ARRIVAL_BURSTY:
+		return 4.0;
+	case ARRIVAL_DAY:
+		return 1.5;
+	default:
+		return 1.0;
+	}
+}
+
+/* which way the traffic leans at time ms: 1 up-peak, -1 down-peak, 0
+neither */
+static int arrival_peak(const struct arrivals *a, double ms) {
+	double phase;
+
+	switch (a->model) {
+	case ARRIVAL_UP_PEAK:
+		return 1;
+	case ARRIVAL_DOWN_PEAK:
+		return -1;
+	case ARRIVAL_DAY:
+		phase = fmod(ms, a->day_ms) / a->day_ms;
+		return phase < 0.25 ? 1 : phase >= 0.75 ? -1 : 0;
+	default:
+		return 0;
+	}
+}
+
+static int arrival_type(struct arrivals *a) {
+	int total, pick;
+
+	if (a->type_weights[0] == 1 && a->type_weights[1] == 1 &&
+			a->type_weights[2] == 1) {
+		return arrival_rnd(a, 0, 2);
+	}
+	total = a->type_weights[0] + a->type_weights[1] + a->type_weights[2];
+	pick = arrival_rng(a) % total;
+	return pick < a->type_weights[0] ? 0 :
+		pick < a->type_weights[0] + a->type_weights[1] ? 1 : 2;
+}
+
+/* Advance to the next arrival and describe the passenger in req; returns
+its time in ms since the stream started. Time-varying rates are drawn
+by thinning a Poisson process at the peak rate. */
+static double arrival_next(struct arrivals *a, struct elevator_request *req) {
+	double peak;
+	int lean;
+
+	peak = arrival_max_intensity(a);
+	do {
+		a->now_ms += -log(arrival_unit(a)) * 60000.0 / (a->rate * peak);
+	} while (peak != 1.0 &&
+		arrival_unit(a) * peak > arrival_intensity(a, a->now_ms));
+
+	req->type = arrival_type(a);
+	lean = arrival_peak(a, a->now_ms);
+	if (lean != 0 && arrival_rnd(a, 1, 100) <= ARRIVAL_PEAK_PCT) {
+		/* to or from the lobby */
+		if (lean > 0) {
+			req->start = 1;
+			req->dest = arrival_rnd(a, 2, a->floors);
+		} else {
+			req->start = arrival_rnd(a, 2, a->floors);
+			req->dest = 1;
+		}
+		return a->now_ms;
+	}
+	req->start = arrival_rnd(a, 1, a->floors);
+	do {
+		req->dest = arrival_rnd(a, 1, a->floors);
+	} while (req->dest == req->start);
+	return a->now_ms;
+}
+
+#endif
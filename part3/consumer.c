@@ -15,6 +15,9 @@ int main(int argc, char **argv){
 	if(strcmp(argv[1], "--start") == 0){
 		ret = start_elevator();
 		printf("Start elevator returned %ld\n", ret);
+		printf("%d cars, %d floors, capacity %d\n",
+			elevator_param("num_cars", 1), elevator_param("num_floors", 10),
+			elevator_param("capacity", 10));
 	}
 	else if(strcmp(argv[1], "--stop") == 0){
 		ret = stop_elevator();
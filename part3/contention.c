@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "wrappers.h"
+
+/*
+ This program measures how well concurrent producers scale.
+ It starts T threads, each issuing N requests from its own start floor
+ (thread i uses floor i % num_floors + 1), and reports the aggregate request rate
+ and the mean time spent in issue_request(). Run it with the elevator
+ started; compare T=1 against larger T to see lock contention.
+*/
+
+struct producer {
+	pthread_t thread;
+	int floor;
+	int floors;
+	int num;
+	int rejected;
+	double busy_ms;
+};
+
+pthread_barrier_t start_line;
+
+double elapsed_ms(struct timespec *t0, struct timespec *t1){
+	return (t1->tv_sec - t0->tv_sec) * 1000.0 +
+		(t1->tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+void *produce(void *arg){
+	struct producer *p = arg;
+	struct timespec t0, t1;
+	unsigned int seed = p->floor;
+	int i, dest, type;
+
+	pthread_barrier_wait(&start_line);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i=0; i < p->num;i+=1)
+	{
+		type = rand_r(&seed) % 3;
+		do {
+			dest = rand_r(&seed) % p->floors + 1;
+		} while(dest == p->floor);
+
+		if(issue_request(p->floor, dest, type) != 0)
+			p->rejected += 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	p->busy_ms = elapsed_ms(&t0, &t1);
+	return NULL;
+}
+
+int main(int argc, char **argv){
+	struct producer *producers;
+	struct timespec t0, t1;
+	int threads, num, floors, i, rejected;
+	double ms, busy_ms;
+
+	if(argc != 3){
+		printf("wrong number of args. contention.x num_of_threads requests_per_thread\n");
+		return -1;
+	}
+	sscanf(argv[1], "%d", &threads);
+	sscanf(argv[2], "%d", &num);
+	if(threads < 1 || num < 1){
+		printf("both arguments must be positive\n");
+		return -1;
+	}
+
+	producers = calloc(threads, sizeof(*producers));
+	if(producers == NULL)
+		return -1;
+	pthread_barrier_init(&start_line, NULL, threads + 1);
+	floors = elevator_param("num_floors", 10);
+
+	for(i=0; i < threads;i+=1){
+		producers[i].floor = i % floors + 1;
+		producers[i].floors = floors;
+		producers[i].num = num;
+		pthread_create(&producers[i].thread, NULL, produce, &producers[i]);
+	}
+
+	pthread_barrier_wait(&start_line);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	rejected = 0;
+	busy_ms = 0;
+	for(i=0; i < threads;i+=1){
+		pthread_join(producers[i].thread, NULL);
+		rejected += producers[i].rejected;
+		busy_ms += producers[i].busy_ms;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ms = elapsed_ms(&t0, &t1);
+	printf("threads: %d\n", threads);
+	printf("requests: %d (%d rejected)\n", threads * num, rejected);
+	printf("elapsed: %.3f ms\n", ms);
+	printf("throughput: %.0f requests/s\n", ms > 0 ? threads * num * 1000.0 / ms : 0.0);
+	printf("mean issue_request latency: %.3f us\n",
+		busy_ms * 1000.0 / ((double)threads * num));
+
+	pthread_barrier_destroy(&start_line);
+	free(producers);
+	return 0;
+}
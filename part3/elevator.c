@@ -1,133 +1,611 @@
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/version.h>
 #include <linux/kernel.h>
 #include <linux/linkage.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
 #include <linux/uaccess.h>
 #include <linux/list.h>
-#include <linux/kthread.h>
+#include <linux/workqueue.h>
 #include <linux/sched.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/atomic.h>
 #include <linux/delay.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+#include <linux/bitmap.h>
 #include<linux/slab.h>
+#include <linux/moduleparam.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/compat.h>
+#include "elevator_uapi.h"
+
+#define CREATE_TRACE_POINTS
+#include "elevator_trace.h"
 MODULE_LICENSE("GPL");
 
-/* syscall stubs */
+/* Syscall stubs, exported by the course's patched kernel. Built with 
+ELEVATOR_SYSCALLS unset (make SYSCALLS=0) the module loads on a stock 
+kernel and is driven through /dev/elevator alone. */
+#ifdef ELEVATOR_SYSCALLS
 extern long (*STUB_start_elevator)(void);
 extern long (*STUB_issue_request)(int, int, int);
 extern long (*STUB_stop_elevator)(void);
+extern long (*STUB_issue_request_batch)(struct elevator_request __user *, int);
+#endif
 
 /* proc fs */
 #define PROC_NAME "elevator"
-#define PROC_SIZE 4096
 #define PROC_PERMS 0644
 #define PROC_PARENT NULL
+#define STATS_PROC_NAME "elevator_stats"
+#define STATS_PROC_PERMS 0444
+#define LATENCY_PROC_NAME "elevator_latency"
+
+/* control and event device, /dev/elevator */
+#define DEV_NAME "elevator"
 
 /**
  * Holds information about the proc fs file
  *
  */
 static struct proc_dir_entry *proc_file;
-
-/**
- * The buffer used with proc fs
- *
- */
-static char *procfs_buffer;
+static struct proc_dir_entry *stats_proc_file;
+static struct proc_dir_entry *latency_proc_file;
 
 /* Elevator constants */
-#define CAPACITY 10
-#define NUM_FLOORS 10
 #define LOBBY 1
+#define MAX_FLOORS 1000
+#define MAX_CAPACITY 1000
+#define MAX_CARS ELEVATOR_STATS_MAX_CARS /* one stats slot per car */
+
+/* the building, fixed at module load */
+static int num_cars = 1;
+module_param(num_cars, int, 0444);
+MODULE_PARM_DESC(num_cars, "number of elevator cars (1-16)");
+static int num_floors = 10;
+module_param(num_floors, int, 0444);
+MODULE_PARM_DESC(num_floors, "number of floors (2-1000)");
+static int capacity = 10;
+module_param(capacity, int, 0444);
+MODULE_PARM_DESC(capacity, "passengers a car holds (1-1000)");
+
+/* Timings, in milliseconds of building time. The building runs 
+time_compression times faster than the wall clock, so a day of traffic 
+can be replayed in minutes; latencies are still reported in building 
+time. All of them may be changed while the elevator runs and take effect 
+at the next floor or stop. A car's work cannot run more than once a 
+jiffy, so compression is limited to what keeps the shorter of floor_ms 
+and load_ms at least a jiffy of wall time. */
+static unsigned int floor_ms = 2000; /* travel time between two floors */
+static unsigned int load_ms = 1000; /* time spent at a stop */
+static unsigned int idle_poll_ms; /* 0: an idle car sleeps until woken */
+static unsigned int time_compression = 1;
+
+/* are the timings usable: none zero, and a floor or a stop at least a 
+jiffy of wall time */
+static int timings_valid(unsigned int floor, unsigned int load, 
+unsigned int compression) {
+	return floor > 0 && load > 0 && compression > 0 && 
+		(u64)min(floor, load) * NSEC_PER_MSEC >= (u64)compression * TICK_NSEC;
+}
+
+/* setter of floor_ms, load_ms and time_compression */
+static int timing_set(const char *val, const struct kernel_param *kp) {
+	unsigned int n, floor, load, compression;
+	int ret;
+
+	ret = kstrtouint(val, 0, &n);
+	if (ret) {
+		return ret;
+	}
+	floor = kp->arg == &floor_ms ? n : READ_ONCE(floor_ms);
+	load = kp->arg == &load_ms ? n : READ_ONCE(load_ms);
+	compression = kp->arg == &time_compression ? n : 
+		READ_ONCE(time_compression);
+	if (!timings_valid(floor, load, compression)) {
+		return -EINVAL;
+	}
+	WRITE_ONCE(*(unsigned int *)kp->arg, n);
+	return 0;
+}
+
+static int timing_get(char *buffer, const struct kernel_param *kp) {
+	return sprintf(buffer, "%u\n", READ_ONCE(*(unsigned int *)kp->arg));
+}
+
+static const struct kernel_param_ops timing_ops = {
+	.set = timing_set,
+	.get = timing_get,
+};
+
+module_param_cb(floor_ms, &timing_ops, &floor_ms, 0644);
+MODULE_PARM_DESC(floor_ms, "travel time between two floors, in ms");
+module_param_cb(load_ms, &timing_ops, &load_ms, 0644);
+MODULE_PARM_DESC(load_ms, "time the doors stay open at a stop, in ms");
+module_param(idle_poll_ms, uint, 0644);
+MODULE_PARM_DESC(idle_poll_ms, "how often an idle car re-checks its "
+	"queue and policy, in ms (0: only when woken)");
+module_param_cb(time_compression, &timing_ops, &time_compression, 0644);
+MODULE_PARM_DESC(time_compression, "run the building this many times "
+	"faster than real time (floor_ms and load_ms must stay a jiffy)");
+
+/* ms of building time in ns of the wall clock */
+static u64 building_ns(unsigned int ms) {
+	return div64_u64((u64)ms * NSEC_PER_MSEC, READ_ONCE(time_compression));
+}
+
+/* ms of building time in jiffies of the wall clock, rounded up */
+static unsigned long building_delay(unsigned int ms) {
+	return nsecs_to_jiffies(building_ns(ms) + TICK_NSEC - 1);
+}
+
+/* wall-clock jiffies until t, rounded up; 0 if it has passed */
+static unsigned long jiffies_until(ktime_t t) {
+	s64 ns;
+
+	ns = ktime_to_ns(ktime_sub(t, ktime_get()));
+	return ns > 0 ? nsecs_to_jiffies(ns + TICK_NSEC - 1) : 0;
+}
+
+/* building time elapsed between two timestamps, in ms */
+static s64 building_ms(ktime_t later, ktime_t earlier) {
+	return div64_s64(ktime_us_delta(later, earlier) * 
+		READ_ONCE(time_compression), USEC_PER_MSEC);
+}
+
+static ktime_t building_epoch; /* module load */
+
+/* building time since module load, in ms */
+static u64 building_clock(void) {
+	return building_ms(ktime_get(), building_epoch);
+}
 
 typedef enum {OFFLINE, IDLE, LOADING, UP, DOWN } State;
 typedef enum {WOLF = 2, SHEEP = 1, GRAPE = 0} PassengerType;
+#define NUM_TYPES 3
+
+/* why a waiting passenger was not taken on board (see elevator_trace.h) */
+typedef enum {REJECT_NONE, REJECT_CAPACITY, REJECT_WOLF_SHEEP, 
+	REJECT_SHEEP_GRAPE, REJECT_DIRECTION} RejectReason;
 
 /* Passenger list item */
 typedef struct Passenger {
+	int start; /* start floor */
 	int destination; /* destinatin floor */
 	PassengerType type;
+	u32 id; /* reported to the producer and in events */
+	ktime_t enqueued; /* when issue_request() accepted the passenger */
+	ktime_t boarded;
+	unsigned int skips; /* stops where the boarding optimiser left them */
 	struct list_head list; 
 } Passenger;
 
+/* Passenger allocation */
+#define PASSENGER_POOL_SIZE 64
+
+/* Preallocated Passenger objects, handed out before falling back to the 
+slab cache. Free objects are linked through Passenger.list. */
+typedef struct PassengerPool {
+	spinlock_t lock;
+	struct list_head free;
+	int num_free;
+	unsigned long hits; /* allocations served from the pool */
+	unsigned long misses; /* allocations that went to the slab cache */
+} PassengerPool;
+
+static struct kmem_cache *passenger_cache;
+static PassengerPool passenger_pool;
+
+/* Locking. The lock order is elevator.sem -> car->mutex -> floor->lock, 
+and at most one floor lock is held at a time.
+ - elevator.sem is taken for writing to start or stop the bank and for 
+   reading by producers and /proc, so the lists stay alive under them.
+ - car->mutex protects the car's state, position and on-board list.
+ - floor->lock protects one car's waiting list on one floor, so producers 
+   enqueueing on different floors do not serialise. 
+ car->num_waiting is atomic so producers never need the car lock, and 
+ producers normally hand passengers over through the car's lock-free 
+ ingress ring instead of taking a floor lock at all. 
+ /proc never takes car->mutex: it reads the car's published CarStats 
+ under car->stats_seq and walks the floor lists under their spinlocks. 
+ The car's floor bitmaps mirror the lists so the scheduler does not have 
+ to walk them: waiting_up/waiting_down change under the floor's lock 
+ with atomic bitops and may be read without it, getting_off belongs to 
+ car->mutex. 
+ events_lock (delivery events) nests inside all of them. 
+ A car's step and dir belong to its work item, which the workqueue never 
+ runs twice at once; producers reach it only through car_wake(). */
+
 /* Floor list of passengers */
 typedef struct Floor {
+	spinlock_t lock;
 	int num_of_passengers;
+	int num_up; /* of which going up */
+	int num_down;
 	struct list_head list; 
 } Floor;
 
-/* Elevator */
-typedef struct Elevator {	
+/* Ingress ring: a bounded lock-free multi-producer single-consumer queue 
+of new passengers for one car (Vyukov's bounded queue). Producers claim a 
+position by advancing head with cmpxchg and publish the slot by storing 
+its sequence number; one consumer at a time, holding lock, takes them at 
+tail. A slot whose sequence equals the position is free for that 
+position, and one whose sequence is position + 1 is full. The consumer 
+is the car's car_step(), or a producer that found the ring full and 
+empties it before adding its passenger, so nobody overtakes the 
+passengers still in the ring. */
+#define INGRESS_RING_SIZE 256 /* power of two */
+
+typedef struct IngressSlot {
+	unsigned int seq;
+	Passenger *passenger;
+} IngressSlot;
+
+typedef struct IngressRing {
+	atomic_t head; /* next position claimed by a producer */
+	unsigned int tail; /* next position read by car_step() */
+	atomic_t overflows; /* pushes that found the ring full */
+	spinlock_t lock; /* held by the consumer */
+	IngressSlot slots[INGRESS_RING_SIZE];
+} IngressRing;
+
+struct Car;
+
+/* Scheduling policy of a car. car_step() calls the hooks at every 
+floor, without locks unless noted:
+ - should_stop: whether to open the doors at floor while heading dir.
+ - next_target: the floor to head for from the current floor, updating 
+   *dir; 0 when there is nothing on board or waiting. It may return the 
+   current floor only together with a change of *dir.
+ - board: move passengers waiting at floor onto the car in the policy's 
+   order (car->mutex held). */
+typedef struct Policy {
+	const char *name;
+	int (*should_stop)(struct Car *, int, int);
+	int (*next_target)(struct Car *, int *);
+	void (*board)(struct Car *, int, int);
+} Policy;
+
+/* Latency histograms, in milliseconds on a log2 scale: bucket 0 counts 
+[0, 2) ms and bucket i counts [2^i, 2^(i+1)) ms; the last bucket also 
+takes everything longer. */
+#define HIST_BUCKETS 24 /* up to 2^24 ms, about 4.6 hours */
+
+typedef struct Histogram {
+	unsigned long count;
+	u64 sum; /* ms */
+	unsigned long max; /* ms */
+	unsigned long buckets[HIST_BUCKETS];
+} Histogram;
+
+typedef enum {LAT_WAIT, LAT_RIDE, LAT_E2E} LatencyKind;
+#define NUM_LATENCIES 3
+
+/* wait (enqueue to board), ride (board to delivery) and end-to-end times 
+of the passengers a car delivered since module load, by passenger type 
+and by start floor */
+typedef struct Latency {
+	Histogram by_type[NUM_LATENCIES][NUM_TYPES];
+	Histogram *by_floor[NUM_LATENCIES]; /* num_floors each */
+} Latency;
+
+/* Car figures shown in /proc, republished by car_step() (with 
+car->mutex held) whenever one of them changes */
+typedef struct CarStats {
+	State state;
+	int current_floor;
+	int direction;
+	int target;
+	int num_of_passengers;
+	int num_wolves;
+	int num_sheep;
+	int num_grapes;
+	int num_serviced;
+	unsigned long floors_travelled;
+	unsigned long stops;
+} CarStats;
+
+/* what a car's next car_step() does */
+#define STEP_DECIDE 0
+#define STEP_LOAD 1
+#define STEP_ARRIVE 2
+#define STEP_DONE 3 /* stopped until the next start */
+
+/* Car: one elevator of the bank, driven by its work item (see 
+car_step()). Each car serves the passengers the dispatcher assigned to 
+it, so it keeps its own per-floor waiting lists. */
+typedef struct Car {
+	int id;
 	State state;	
 	int current_floor;
+	int direction; /* UP or DOWN */
+	int target; /* floor the car is currently heading to */
 	int num_of_passengers;
-	int num_waiting;
+	int num_wolves; /* passengers on the board by type */
+	int num_sheep;
+	int num_grapes;
+	atomic_t num_waiting;
 	int num_serviced;
-	int deactivating;
+	unsigned long floors_travelled; /* since module load */
+	unsigned long stops; /* since module load */
 	struct list_head list; /* passengers on the board */
 	struct mutex mutex;
-
-	Floor floors[NUM_FLOORS];
+	struct delayed_work work; /* runs car_step() when the next step is due */
+	int step; /* STEP_*, what car_step() does next */
+	int dir; /* direction the policy is sweeping in */
+	atomic_t idle; /* parked with nothing to do, see car_wake() */
+	ktime_t due; /* wall time the pending step was due, see car_step() */
+	const Policy *policy; /* changed by car_step() while idle only */
+	Latency latency; /* updated with car->mutex held */
+	IngressRing ingress; /* new passengers not yet on a floor list */
+	seqcount_t stats_seq; /* writers hold car->mutex */
+	CarStats stats;
+
+	Floor *floors; /* num_floors floors of passengers assigned to this car */
+	/* num_floors + 1 bits, bit i is floor i: someone waits there to go 
+	up / down, or someone on the board gets off there 
+	(num_getting_off[i - 1] of them) */
+	unsigned long *waiting_up;
+	unsigned long *waiting_down;
+	unsigned long *getting_off;
+	int *num_getting_off;
+} Car;
+
+/* Elevator bank */
+typedef struct Elevator {	
+	State state; /* OFFLINE, or IDLE while the bank is running */
+	int deactivating; /* 0, or the STOP_* in progress */
+	struct rw_semaphore sem; /* start/stop vs. everyone else */
+	Car *cars; /* num_cars cars */
+	atomic_t requests; /* accepted requests since module load */
+	atomic_t rejected; /* rejected requests since module load */
+	unsigned long serviced_base; /* serviced in earlier runs */
+	/* admission control: passengers admitted and not yet on board, the 
+	same by start floor (num_floors), Passenger objects alive, and 
+	requests refused by each limit since module load */
+	atomic_t waiting;
+	atomic_t *floor_waiting;
+	atomic_t live;
+	atomic_t shed_waiting;
+	atomic_t shed_floor;
+	atomic_t shed_memory;
+	atomic_t running; /* cars whose car_step() has not finished */
+	struct delayed_work stop_work; /* elevator_stopped(), after the last car */
+	wait_queue_head_t stopped; /* woken once the bank is OFFLINE */
+	ktime_t drain_end; /* when a stop expects to be done */
+	atomic_t dropped; /* riders put off early by fast stops */
 } Elevator;
 
 static Elevator elevator;
-
-/* Thread parameter */
-struct thread_parameter {	
-	int id;
-	struct task_struct *kthread;	
-};
-
-static struct thread_parameter elevator_thread;
+/* runs the cars' work while the bank is started */
+static struct workqueue_struct *elevator_wq;
+
+/* Stopping. STOP_DRAIN, the default, lets each car deliver everyone on 
+its board first, which can take a while in a tall building; STOP_FAST 
+(the fast_stop parameter, ELEVATOR_IOC_STOP_FAST, and rmmod) puts them 
+off at the floor the car reaches next, within a step. Either way the 
+passengers still waiting are dropped. A stopper waits interruptibly: on 
+a signal it returns while the cars finish on their own. */
+#define STOP_DRAIN 1
+#define STOP_FAST 2
+
+static bool fast_stop;
+module_param(fast_stop, bool, 0644);
+MODULE_PARM_DESC(fast_stop, "stop_elevator() puts riders off at the next "
+	"floor instead of delivering them");
+
+/* Admission control. A request is refused with -EAGAIN while max_waiting 
+passengers wait in the building or max_waiting_per_floor at its start 
+floor, and with -EBUSY while the Passenger objects alive (waiting or 
+riding) would exceed passenger_budget_kb. 0 means no limit. The limits 
+keep both memory and the scheduler's work bounded under overload. */
+static unsigned int max_waiting;
+module_param(max_waiting, uint, 0644);
+MODULE_PARM_DESC(max_waiting, "passengers allowed to wait in the building "
+	"(0: no limit)");
+static unsigned int max_waiting_per_floor;
+module_param(max_waiting_per_floor, uint, 0644);
+MODULE_PARM_DESC(max_waiting_per_floor, "passengers allowed to wait on "
+	"one floor (0: no limit)");
+static unsigned int passenger_budget_kb;
+module_param(passenger_budget_kb, uint, 0644);
+MODULE_PARM_DESC(passenger_budget_kb, "memory for queued and riding "
+	"passengers, in KiB (0: no limit)");
+
+/* Idle parking. Arrivals are counted per start floor in windows of an 
+hour of building time (so 24 windows make a day); each window's counts 
+decay by a quarter every day it sees traffic again, so recent days weigh 
+most. With park set, a car with nothing to do heads for where the next 
+call is likeliest to come from in the current hour: the weighted median 
+of the window's arrivals, which minimises the expected travel to a 
+pickup. Cars of a bank spread over the quantiles instead, car i of n at 
+(2i - 1) / 2n. */
+#define DEMAND_WINDOW_MS (3600 * 1000ULL)
+#define DEMAND_WINDOWS 24
+#define DEMAND_ONE 256 /* weight of one arrival */
+
+typedef struct Demand {
+	atomic_t day[DEMAND_WINDOWS]; /* building day each window last counted */
+	atomic_t *arrivals; /* DEMAND_WINDOWS rows of num_floors */
+} Demand;
+
+static Demand demand;
+
+/* The binary statistics region behind /proc/elevator_stats (layout in 
+elevator_uapi.h). A car that publishes new figures rewrites only its own 
+entry and its share of the bank totals, under stats_lock and bracketed by 
+seq so mmap readers can sample it without a syscall; the per-floor 
+waiting counts are kept in step one atomic add at a time by 
+count_waiting(). */
+static struct elevator_stats *stats_page;
+static atomic_t *stats_waiting; /* num_floors counts, in stats_page */
+static size_t stats_size; /* page aligned, set by stats_init() */
+static DEFINE_SPINLOCK(stats_lock);
 
 /* Prototypes */
 
 long my_start_elevator(void);
 long my_issue_request(int, int, int);
 long my_stop_elevator(void);
+long my_issue_request_batch(struct elevator_request __user *, int);
 
-static ssize_t proc_read(struct file *, char __user *, size_t, loff_t *);
+static int proc_open(struct inode *, struct file *);
 static int elevator_activate(void);
-static void elevator_deactivate(void);
-static int elevator_run(void *);
-static void thread_init_parameter(struct thread_parameter *);
-static void elevator_load(int floor, int dir);
-static void elevator_unload(int floor);
+static int elevator_deactivate(int);
+static void elevator_stopped(struct work_struct *);
+static void car_step(struct work_struct *);
+static void car_wake(Car *);
+static void elevator_load(Car *car, int floor, int dir);
+static void elevator_unload(Car *car, int floor);
+static Car *dispatch_passenger(Passenger *);
+static void enqueue_passenger(Car *, Passenger *);
+static void floor_add(Car *, Passenger *);
+static void ingress_init(IngressRing *);
+static int ingress_push(IngressRing *, Passenger *);
+static Passenger *ingress_pop(IngressRing *);
+static void drain_ingress_locked(Car *);
+static void drain_ingress(Car *);
 static long add_passenger(int, int, PassengerType);
+static long add_passengers(struct elevator_request *, int);
+static int is_valid_request(int, int, int);
 static char *state_to_string(State);
 static char *passenger_to_string(PassengerType);
-static unsigned long make_buffer(void);
-static void count_passengers(int *, int *, int *);
-static int can_load(int, int, int, Passenger *, int);
+static void publish_stats(Car *);
+static void read_stats(Car *, CarStats *);
+static void stats_update(void);
+static void stats_update_car(Car *);
+static void count_passenger(Car *, PassengerType, int);
+static void board_passenger(Car *, Floor *, Passenger *);
+static void record_latency(Car *, Passenger *);
+static int demand_init(void);
+static int admit(int);
+static void leave_queue(int);
+static void record_demand(int);
+static int passenger_pool_init(void);
+static void passenger_pool_destroy(void);
+static Passenger *alloc_passenger(void);
+static void free_passenger(Passenger *);
+static int can_board(Car *, Passenger *);
+static RejectReason board_check(Car *, Passenger *);
+static RejectReason load_check(Car *, Passenger *, int);
+static void set_state(Car *, State);
+static int next_floor(const unsigned long *, int);
+static int prev_floor(const unsigned long *, int);
+static const Policy *selected_policy(void);
+static void publish_event(Car *, Passenger *, int, int);
+
+static int latency_open(struct inode *, struct file *);
+static int stats_mmap(struct file *, struct vm_area_struct *);
+static ssize_t stats_read(struct file *, char __user *, size_t, loff_t *);
+
+/* proc_create() takes struct proc_ops from 5.6 on */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+static const struct proc_ops proc_fops = {
+ .proc_open = proc_open,
+ .proc_read = seq_read,
+ .proc_lseek = seq_lseek,
+ .proc_release = seq_release,
+};
+
+static const struct proc_ops latency_fops = {
+ .proc_open = latency_open,
+ .proc_read = seq_read,
+ .proc_lseek = seq_lseek,
+ .proc_release = single_release,
+};
 
-/* proc fs file operation (only "read" implemented) */
+static const struct proc_ops stats_fops = {
+ .proc_read = stats_read,
+ .proc_mmap = stats_mmap,
+};
+#else
+/* proc fs file operations, streamed through seq_file */
 static const struct file_operations proc_fops = {
  .owner = THIS_MODULE, 
- .read  = proc_read,
+ .open = proc_open,
+ .read  = seq_read,
+ .llseek = seq_lseek,
+ .release = seq_release,
 };
 
-/* Implementation */
+/* latency histograms file operations */
+static const struct file_operations latency_fops = {
+ .owner = THIS_MODULE, 
+ .open = latency_open,
+ .read  = seq_read,
+ .llseek = seq_lseek,
+ .release = single_release,
+};
 
-/* runs the elevator thread */
-static void thread_init_parameter(struct thread_parameter *parm) {
-	static int id = 1;	
+/* binary stats file operations */
+static const struct file_operations stats_fops = {
+ .owner = THIS_MODULE, 
+ .read = stats_read,
+ .mmap = stats_mmap,
+};
+#endif
+
+/* /dev/elevator file operations */
+static int dev_open(struct inode *, struct file *);
+static int dev_release(struct inode *, struct file *);
+static ssize_t dev_read(struct file *, char __user *, size_t, loff_t *);
+static ssize_t dev_write(struct file *, const char __user *, size_t, loff_t *);
+static __poll_t dev_poll(struct file *, poll_table *);
+static long dev_ioctl(struct file *, unsigned int, unsigned long);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0) && defined(CONFIG_COMPAT)
+static long dev_compat_ioctl(struct file *, unsigned int, unsigned long);
+#endif
+
+static const struct file_operations dev_fops = {
+ .owner = THIS_MODULE, 
+ .open = dev_open,
+ .release = dev_release,
+ .read = dev_read,
+ .write = dev_write,
+ .poll = dev_poll,
+ .unlocked_ioctl = dev_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+ .compat_ioctl = compat_ptr_ioctl,
+#elif defined(CONFIG_COMPAT)
+ .compat_ioctl = dev_compat_ioctl,
+#endif
+ .llseek = noop_llseek,
+};
 
-	parm->id = id++;	
-	parm->kthread = kthread_run(elevator_run, parm, "elevator thread %d", parm->id);
-} 
+/* anyone may queue passengers or start and stop the bank, as with the 
+system calls; changing the configuration checks CAP_SYS_ADMIN */
+static struct miscdevice elevator_dev = {
+ .minor = MISC_DYNAMIC_MINOR,
+ .name = DEV_NAME,
+ .fops = &dev_fops,
+ .mode = 0666,
+};
+
+/* Implementation */
 
 /* to convert elevator state to string */
 static char *state_to_string(State s) {
 	static char state_buffer[8];
 	if (s == OFFLINE) {
 		strcpy(state_buffer, "OFFLINE");
-	} else if (elevator.state == IDLE) {
+	} else if (s == IDLE) {
 		strcpy(state_buffer, "IDLE");
-	} else if (elevator.state == LOADING) {
+	} else if (s == LOADING) {
 		strcpy(state_buffer, "LOADING");
-	} else if (elevator.state == UP) {
+	} else if (s == UP) {
 		strcpy(state_buffer, "UP");
-	} else if (elevator.state == DOWN) {
+	} else if (s == DOWN) {
 		strcpy(state_buffer, "DOWN");
 	}
 	return state_buffer;
@@ -146,672 +624,2605 @@ static char *passenger_to_string(PassengerType p) {
 	return passenger_buffer;
 }
 
-/* make buffer for procfs reading */
-static unsigned long make_buffer(void) {
-	unsigned long len;
-	int i, wolves, sheep, grapes;
-	char elevator_sym;
-	struct list_head *temp;	
-	Passenger *p;
+/* copy the car figures last published by car_step(); retries while 
+an update is in progress instead of taking car->mutex */
+static void read_stats(Car *car, CarStats *stats) {
+	unsigned int seq;
 
-	len = 0;		
-
-	len += sprintf(procfs_buffer + len, "Elevator state: %s\n", 
-		state_to_string(elevator.state));
-
-	if (elevator.state != OFFLINE) {
-		/* count passengers on the board */
-		count_passengers(&wolves, &sheep, &grapes);
-
-		len += sprintf(procfs_buffer + len,
-				"Elevator status: %d wolves, %d sheep, %d grapes\n", 
-				wolves, sheep, grapes);
-		len += sprintf(procfs_buffer + len, 
-				"Current floor: %d\n", elevator.current_floor);
-		len += sprintf(procfs_buffer + len, 
-				"Number of passengers: %d\n", 
-				elevator.num_of_passengers);
-		len += sprintf(procfs_buffer + len, 
-				"Number of passengers waiting: %d\n", 
-				elevator.num_waiting);
-		len += sprintf(procfs_buffer + len, 
-				"Number passengers serviced: %d\n\n", 	
-				elevator.num_serviced);
-
-		/* floors */
-		for (i = NUM_FLOORS; i >= LOBBY ; --i) {
-			if (elevator.current_floor == i) {
-				elevator_sym = '*';
-			} else {
-				elevator_sym = ' ';
-			}
-			len += sprintf(procfs_buffer + len, 
-					"[%c] Floor %d: %d", 
-					elevator_sym, i, 
-					elevator.floors[i - 1].num_of_passengers);
-
-			/* list all waiting passengers on this floor in FIFO order */
-			list_for_each(temp, &elevator.floors[i - 1].list) {
-				p = list_entry(temp, Passenger, list);	
-				len += sprintf(procfs_buffer + len, " %s", 
-				passenger_to_string(p->type));
-			} 
+	do {
+		seq = read_seqcount_begin(&car->stats_seq);
+		*stats = car->stats;
+	} while (read_seqcount_retry(&car->stats_seq, seq));
+}
 
-			len += sprintf(procfs_buffer + len, "\n");
-		}
-	}
-	
-	return len; /* return length of the resulting string */
+/* publish the car figures for /proc (car->mutex held) */
+static void publish_stats(Car *car) {
+	/* car->mutex does not keep the writer on the CPU, and a reader 
+	spinning on an odd count must not wait out a preempted writer */
+	preempt_disable();
+	write_seqcount_begin(&car->stats_seq);
+	car->stats.state = car->state;
+	car->stats.current_floor = car->current_floor;
+	car->stats.direction = car->direction;
+	car->stats.target = car->target;
+	car->stats.num_of_passengers = car->num_of_passengers;
+	car->stats.num_wolves = car->num_wolves;
+	car->stats.num_sheep = car->num_sheep;
+	car->stats.num_grapes = car->num_grapes;
+	car->stats.num_serviced = car->num_serviced;
+	car->stats.floors_travelled = car->floors_travelled;
+	car->stats.stops = car->stops;
+	write_seqcount_end(&car->stats_seq);
+	preempt_enable();
+
+	stats_update_car(car);
 }
 
-/* count passengers on the board */
-static void count_passengers(int *wolves, int *sheep, int *grapes) {
-	struct list_head *temp;	
-	Passenger *p;
+/* the bank-wide counters of the stats region (stats_lock held, inside 
+the seq bracket) */
+static void stats_write_bank(struct elevator_stats *s) {
+	s->state = READ_ONCE(elevator.state) != OFFLINE;
+	s->requests = (unsigned int)atomic_read(&elevator.requests);
+	s->rejected = (unsigned int)atomic_read(&elevator.rejected);
+	s->shed = atomic_read(&elevator.shed_waiting) + 
+		atomic_read(&elevator.shed_floor) + 
+		atomic_read(&elevator.shed_memory);
+}
 
-	*wolves = *sheep = *grapes = 0;
-	list_for_each(temp, &elevator.list) {
-		p = list_entry(temp, Passenger, list);	
-		if (p->type == WOLF) {
-			*wolves += 1;
-		} else if (p->type == SHEEP) {
-			*sheep += 1;
-		} else if (p->type == GRAPE) {
-			*grapes += 1;
-		}
-	} 
+/* refresh the bank-wide counters of the stats region */
+static void stats_update(void) {
+	struct elevator_stats *s;
+
+	s = stats_page;
+	spin_lock(&stats_lock);
+	WRITE_ONCE(s->seq, s->seq + 1); /* odd: update in progress */
+	smp_wmb();
+	stats_write_bank(s);
+	smp_wmb();
+	WRITE_ONCE(s->seq, s->seq + 1);
+	spin_unlock(&stats_lock);
 }
 
-/* procfs read operation */
-static ssize_t proc_read(struct file *file, char __user *ubuf, size_t count, 
-loff_t *ppos) 
-{	
-	unsigned long procfs_buffer_size = 0;
+/* rewrite car's entry of the stats region, moving the bank totals by 
+what changed since its last one (car->mutex held) */
+static void stats_update_car(Car *car) {
+	struct elevator_stats *s;
+	struct elevator_stats_car *sc;
+
+	s = stats_page;
+	sc = &s->cars[car->id - 1];
+	spin_lock(&stats_lock);
+	WRITE_ONCE(s->seq, s->seq + 1); /* odd: update in progress */
+	smp_wmb();
+
+	stats_write_bank(s);
+	/* num_serviced restarts from 0 with each run; what the car serviced 
+	before is already in the total */
+	s->serviced += car->num_serviced >= sc->serviced ? 
+		car->num_serviced - sc->serviced : car->num_serviced;
+	s->floors_travelled += car->floors_travelled - sc->floors_travelled;
+	s->stops += car->stops - sc->stops;
+	sc->state = car->state;
+	sc->current_floor = car->current_floor;
+	sc->direction = car->direction;
+	sc->target = car->target;
+	sc->passengers = car->num_of_passengers;
+	sc->wolves = car->num_wolves;
+	sc->sheep = car->num_sheep;
+	sc->grapes = car->num_grapes;
+	sc->waiting = atomic_read(&car->num_waiting);
+	sc->serviced = car->num_serviced;
+	sc->floors_travelled = car->floors_travelled;
+	sc->stops = car->stops;
+
+	smp_wmb();
+	WRITE_ONCE(s->seq, s->seq + 1);
+	spin_unlock(&stats_lock);
+}
 
-	printk(KERN_NOTICE "Elevator: %s\n", __FUNCTION__);	
-	
-	mutex_lock(&elevator.mutex);
+static int stats_init(void) {
+	stats_size = PAGE_ALIGN(sizeof(struct elevator_stats) + 
+		num_floors * sizeof(__u32));
+	stats_page = alloc_pages_exact(stats_size, GFP_KERNEL | __GFP_ZERO);
+	if (stats_page == NULL) {
+		return -ENOMEM;
+	}
+	stats_page->magic = ELEVATOR_STATS_MAGIC;
+	stats_page->version = ELEVATOR_STATS_VERSION;
+	stats_page->size = stats_size;
+	stats_page->num_cars = num_cars;
+	stats_page->num_floors = num_floors;
+	stats_page->capacity = capacity;
+	stats_page->floors_offset = sizeof(struct elevator_stats);
+	stats_waiting = (atomic_t *)((char *)stats_page + 
+		stats_page->floors_offset);
+	return 0;
+}
 
-	if(*ppos == 0) {
-		procfs_buffer_size = make_buffer();	
-	} 
+/* map the stats region read-only into the caller. The pages are inserted 
+one by one rather than remapped as a PFN range so that the mapping holds 
+a reference to each: a process may keep them mapped after rmmod has 
+freed the region. */
+static int stats_mmap(struct file *file, struct vm_area_struct *vma) {
+	unsigned long size, off;
+	int err;
 
-	if (*ppos > 0 || count < procfs_buffer_size) {
-		mutex_unlock(&elevator.mutex);
-		return 0;
+	size = vma->vm_end - vma->vm_start;
+	if (vma->vm_pgoff != 0 || size > stats_size) {
+		return -EINVAL;
 	}
+	if (vma->vm_flags & VM_WRITE) {
+		return -EPERM;
+	}
+	/* vm_flags is read-only from 6.3 on */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		err = vm_insert_page(vma, vma->vm_start + off, 
+			virt_to_page((char *)stats_page + off));
+		if (err) {
+			return err;
+		}
+	}
+	return 0;
+}
 
-	/* copy buffer to user space */
-	if(copy_to_user(ubuf, procfs_buffer, procfs_buffer_size)) {
-		mutex_unlock(&elevator.mutex);
-		return -EFAULT;
-	}	
-	mutex_unlock(&elevator.mutex);
-
-	*ppos = procfs_buffer_size;
-	return procfs_buffer_size;
+/* plain reads return the raw region, for tools that cannot mmap */
+static ssize_t stats_read(struct file *file, char __user *ubuf, size_t count, 
+loff_t *ppos) {
+	return simple_read_from_buffer(ubuf, count, ppos, stats_page, stats_size);
 }
 
-/* returns 1 is elevator is active */
-static int is_active(void) {
-	if (elevator.state == OFFLINE || elevator.deactivating) {
-		return 0;
+/* /proc/elevator is a sequence of records: the summary (position 0) and 
+then one record per floor from the top down, so any number of waiting 
+passengers streams out without a fixed-size buffer. elevator.sem is held 
+for reading from start to stop so the floor lists stay alive. */
+static void *proc_seq_start(struct seq_file *m, loff_t *pos) {
+	down_read(&elevator.sem);
+	if (*pos == 0) {
+		return SEQ_START_TOKEN;
 	}
-	return 1;
+	if (elevator.state == OFFLINE || *pos > num_floors) {
+		return NULL;
+	}
+	return &elevator.cars[0].floors[num_floors - *pos];
 }
 
-/* activates the elevator on start_elevator() syscall */
-static int elevator_activate(void) {
-	int i, err;
+static void *proc_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+	*pos += 1;
+	if (elevator.state == OFFLINE || *pos > num_floors) {
+		return NULL;
+	}
+	return &elevator.cars[0].floors[num_floors - *pos];
+}
 
-	elevator.state = IDLE;	
-	elevator.current_floor = LOBBY;
-	elevator.num_of_passengers = 0;
-	elevator.num_waiting = 0;
-	elevator.num_serviced = 0;
-	elevator.deactivating = 0;
+static void proc_seq_stop(struct seq_file *m, void *v) {
+	up_read(&elevator.sem);
+}
 
-	INIT_LIST_HEAD(&elevator.list);
+/* the summary: one line per car and the bank totals */
+static void proc_show_summary(struct seq_file *m) {
+	int c, passengers, waiting, serviced;
+	CarStats stats;
+	Car *car;
 
-	/* init floors */
-	for (i = 1; i <= NUM_FLOORS; ++i) {
-		elevator.floors[i - 1].num_of_passengers = 0;
-		INIT_LIST_HEAD(&elevator.floors[i - 1].list);
-	}		
+	if (elevator.state == OFFLINE) {
+		seq_printf(m, "Elevator state: %s\n", state_to_string(elevator.state));
+		return;
+	}
 
-	/* Start elevator thread */
-	thread_init_parameter(&elevator_thread);
-	if (IS_ERR(elevator_thread.kthread)) {
-		printk(KERN_WARNING "error spawning thread");		
-		err = PTR_ERR(elevator_thread.kthread);
-	} else {
-		err = 0;
+	passengers = waiting = serviced = 0;
+	for (c = 0; c < num_cars; ++c) {
+		car = &elevator.cars[c];
+		read_stats(car, &stats);
+		seq_printf(m, "Car %d: %s, floor %d, %d passengers "
+				"(%d wolves, %d sheep, %d grapes), %d waiting, "
+				"%d serviced, ring %d/%d (%d overflows), policy %s\n", 
+				car->id, state_to_string(stats.state), 
+				stats.current_floor, stats.num_of_passengers, 
+				stats.num_wolves, stats.num_sheep, stats.num_grapes, 
+				atomic_read(&car->num_waiting), stats.num_serviced, 
+				(int)((unsigned int)atomic_read(&car->ingress.head) - 
+					READ_ONCE(car->ingress.tail)), 
+				INGRESS_RING_SIZE, 
+				atomic_read(&car->ingress.overflows), 
+				READ_ONCE(car->policy)->name);
+		passengers += stats.num_of_passengers;
+		waiting += atomic_read(&car->num_waiting);
+		serviced += stats.num_serviced;
 	}
 
-	return err;
+	if (elevator.deactivating) {
+		seq_printf(m, "Stopping (%s): about %lld s of building time "
+				"left, %d riders put off early\n", 
+				elevator.deactivating == STOP_FAST ? "fast" : "draining", 
+				max_t(s64, building_ms(elevator.drain_end, ktime_get()), 0) / 1000, 
+				atomic_read(&elevator.dropped));
+	}
+	seq_printf(m, "Number of passengers: %d\n", passengers);
+	seq_printf(m, "Number of passengers waiting: %d\n", waiting);
+	seq_printf(m, "Number passengers serviced: %d\n", serviced);
+	seq_printf(m, "Shed requests: %d over max_waiting, %d over "
+			"max_waiting_per_floor, %d over passenger_budget_kb\n", 
+			atomic_read(&elevator.shed_waiting), 
+			atomic_read(&elevator.shed_floor), 
+			atomic_read(&elevator.shed_memory));
+	spin_lock(&passenger_pool.lock);
+	seq_printf(m, "Passenger pool: %d free, %lu hits, %lu misses\n\n", 
+			passenger_pool.num_free, passenger_pool.hits, 
+			passenger_pool.misses);
+	spin_unlock(&passenger_pool.lock);
 }
 
-/* deactivates the elevator on stop_elevator() syscall */
-static void elevator_deactivate(void) {
-	int i;
-	struct list_head *temp;
-	struct list_head *dummy; 
-	Passenger *p;	
-	
-	/* tell the elevator thread to stop */
-	elevator.deactivating = 1;
-	kthread_stop(elevator_thread.kthread); 
-
-	/* elevator stopped now */
-	elevator.state = OFFLINE;	
-
-	/* Clean up lists*/
-	
-	/* cleanup floors */
-	for (i = 1; i <= NUM_FLOORS; ++i) {		
-		list_for_each_safe(temp, dummy, &elevator.floors[i - 1].list) { 
-			p = list_entry(temp, Passenger, list);
-			list_del(temp);	
-			kfree(p);
+/* one floor, marked with '*' when a car is there, followed by its 
+waiting passengers in FIFO order (per car) */
+static int proc_show_floor(struct seq_file *m, int floor) {
+	int c, on_floor, n, i, j;
+	char elevator_sym;
+	struct list_head *temp;	
+	u8 *types;
+	Floor *f;
+
+	elevator_sym = ' ';
+	on_floor = 0;
+	for (c = 0; c < num_cars; ++c) {
+		if (READ_ONCE(elevator.cars[c].stats.current_floor) == floor) {
+			elevator_sym = '*';
+		}
+		on_floor += READ_ONCE(
+			elevator.cars[c].floors[floor - 1].num_of_passengers);
+	}
+	seq_printf(m, "[%c] Floor %d: %d", elevator_sym, floor, on_floor);
+
+	/* the types are copied out under the lock and printed after it, as 
+	seq_file formats the record again when its buffer overflows; whoever 
+	queued after the count was read shows up on the next read */
+	for (c = 0; c < num_cars; ++c) {
+		f = &elevator.cars[c].floors[floor - 1];
+		n = READ_ONCE(f->num_of_passengers);
+		if (n == 0) {
+			continue;
+		}
+		types = kvcalloc(n, sizeof(*types), GFP_KERNEL);
+		if (types == NULL) {
+			return -ENOMEM;
+		}
+		i = 0;
+		spin_lock(&f->lock);
+		list_for_each(temp, &f->list) {
+			if (i == n) {
+				break;
+			}
+			types[i++] = list_entry(temp, Passenger, list)->type;
 		} 
-	}	
-
-	/* cleanup elevator */
-	list_for_each_safe(temp, dummy, &elevator.list) { 
-		p = list_entry(temp, Passenger, list);
-		list_del(temp);	
-		kfree(p);
-	} 
+		spin_unlock(&f->lock);
+		for (j = 0; j < i; ++j) {
+			seq_printf(m, " %s", passenger_to_string(types[j]));
+		}
+		kvfree(types);
+	}
+	seq_putc(m, '\n');
+	return 0;
 }
 
-/* elevator loads passengers on the current floor */
-static void elevator_load(int floor, int dir) {
-	struct list_head *temp;
-	struct list_head *dummy; 
-	Passenger *p;
-	int wolves, sheep, grapes;	
-
-	/* for each passenger on current floor */
-	list_for_each_safe(temp, dummy, &elevator.floors[floor - 1].list) { 		
-		p = list_entry(temp, Passenger, list);
-		/* count passengers on the board to check loading condition */
-		count_passengers(&wolves, &sheep, &grapes);
-		/* check if current passenger can be loaded */
-		if (can_load(wolves, sheep, grapes, p, dir)) {
-			list_del(temp);	/* delete the passenger from the floor */
-			/* add the passenger on the board */	
-			list_add_tail(&p->list, &elevator.list); 
-			/* update statistics */
-			elevator.num_of_passengers += 1; 
-			elevator.floors[floor - 1].num_of_passengers -= 1;
-			elevator.num_waiting -= 1;
-		}		
+static int proc_seq_show(struct seq_file *m, void *v) {
+	if (v == SEQ_START_TOKEN) {
+		proc_show_summary(m);
+	} else {
+		/* v is the floor in car 1; the record covers every car */
+		return proc_show_floor(m, (Floor *)v - elevator.cars[0].floors + 1);
 	}
+	return 0;
 }
 
-/* elevator unloads passengers on the floor */
-static void elevator_unload(int floor) {
-	struct list_head *temp;
-	struct list_head *dummy; 
-	Passenger *p;	
+static const struct seq_operations proc_seq_ops = {
+	.start = proc_seq_start,
+	.next = proc_seq_next,
+	.stop = proc_seq_stop,
+	.show = proc_seq_show,
+};
 
-	/* for each passenger on the board */
-	list_for_each_safe(temp, dummy, &elevator.list) { 
-		p = list_entry(temp, Passenger, list);
-		/* check if current floor is passenger's destination */
-		if (p->destination == floor) {
-			/* delete the passenger from the elevator */
-			list_del(temp);	
-			kfree(p);
-			/* update statistics */
-			elevator.num_of_passengers -= 1;
-			elevator.num_serviced += 1;
-		}		
+/* keep the per-type counts of passengers on the board up to date
+(delta is 1 when a passenger boards and -1 when one gets off) */
+static void count_passenger(Car *car, PassengerType type, int delta) {
+	if (type == WOLF) {
+		car->num_wolves += delta;
+	} else if (type == SHEEP) {
+		car->num_sheep += delta;
+	} else if (type == GRAPE) {
+		car->num_grapes += delta;
 	}
 }
 
-/* add passenger at the floor (by issue_request() */
-static long add_passenger(int start_floor, int dest_floor, PassengerType type) {
-	Passenger *p;
-	long result;
+/* add one sample (in ms) to a histogram */
+static void hist_add(Histogram *h, s64 ms) {
+	unsigned long v;
+	int b;
+
+	v = ms > 0 ? ms : 0;
+	b = v < 2 ? 0 : min(ilog2(v), HIST_BUCKETS - 1);
+	h->buckets[b] += 1;
+	h->count += 1;
+	h->sum += v;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
 
-	result = 1;
+/* add b's samples to a */
+static void hist_merge(Histogram *a, const Histogram *b) {
+	int i;
 
-	mutex_lock(&elevator.mutex);
+	a->count += READ_ONCE(b->count);
+	a->sum += READ_ONCE(b->sum);
+	a->max = max(a->max, READ_ONCE(b->max));
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		a->buckets[i] += READ_ONCE(b->buckets[i]);
+	}
+}
 
-	if (elevator.state != OFFLINE && elevator.deactivating == 0) {
-		/* Allocate a new linked list item */
-		p = kmalloc(sizeof(Passenger) * 1, __GFP_RECLAIM); 
-		if (p == NULL)
-			return -ENOMEM;
+/* upper bound in ms of the pct-th percentile, capped at the maximum */
+static unsigned long hist_percentile(const Histogram *h, int pct) {
+	unsigned long rank, seen;
+	int i;
 
-		p->destination = dest_floor;	
-		p->type = type;		
-		
-		/* insert passenger to the start floor list in FIFO order */	
-		list_add_tail(&p->list, &elevator.floors[start_floor - 1].list);
-		/* update statistics */
-		elevator.floors[start_floor - 1].num_of_passengers += 1; 
-		elevator.num_waiting += 1;
+	if (h->count == 0) {
+		return 0;
+	}
+	rank = (h->count * pct + 99) / 100;
+	seen = 0;
+	for (i = 0; i < HIST_BUCKETS - 1; ++i) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			return min(2UL << i, h->max);
+		}
+	}
+	return h->max;
+}
 
-		result = 0;
+/* record the wait, ride and end-to-end times of a delivered passenger 
+(car->mutex held) */
+static void record_latency(Car *car, Passenger *p) {
+	s64 ms[NUM_LATENCIES];
+	ktime_t now;
+	int k;
+
+	now = ktime_get();
+	ms[LAT_WAIT] = building_ms(p->boarded, p->enqueued);
+	ms[LAT_RIDE] = building_ms(now, p->boarded);
+	ms[LAT_E2E] = building_ms(now, p->enqueued);
+	trace_elevator_unload(car->id, p->destination, p->type, ms[LAT_RIDE]);
+	for (k = 0; k < NUM_LATENCIES; ++k) {
+		hist_add(&car->latency.by_type[k][p->type], ms[k]);
+		hist_add(&car->latency.by_floor[k][p->start - 1], ms[k]);
 	}
+}
 
-	mutex_unlock(&elevator.mutex);
+/* one line of /proc/elevator_latency */
+static void latency_show_hist(struct seq_file *m, const char *kind, 
+const char *label, const Histogram *h) {
+	int i;
 
-	return result;
+	seq_printf(m, "%s %s: n %lu, mean %llu, p50 %lu, p90 %lu, p99 %lu, "
+			"max %lu |", kind, label, h->count, 
+			h->count ? div64_u64(h->sum, h->count) : 0, 
+			hist_percentile(h, 50), hist_percentile(h, 90), 
+			hist_percentile(h, 99), h->max);
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seq_printf(m, " %lu", h->buckets[i]);
+	}
+	seq_putc(m, '\n');
 }
 
-/* Initialization and clean-up */
+/* /proc/elevator_latency: for wait, ride and end-to-end time, the totals 
+and the breakdown by passenger type and by start floor, summed over the 
+cars. The cars keep recording meanwhile, so a line may be a passenger or 
+two behind. */
+static int latency_show(struct seq_file *m, void *v) {
+	static const char *kinds[NUM_LATENCIES] = {"wait", "ride", "e2e"};
+	static const char *types[NUM_TYPES] = {"grape", "sheep", "wolf"};
+	Histogram all, h;
+	char label[24];
+	int k, t, i, c;
+
+	seq_printf(m, "Latency in ms since module load: count, mean, percentile "
+			"upper bounds, max | log2 buckets [0,2) [2,4) ... [2^%d,)\n", 
+			HIST_BUCKETS - 1);
+	for (k = 0; k < NUM_LATENCIES; ++k) {
+		memset(&all, 0, sizeof(all));
+		for (t = 0; t < NUM_TYPES; ++t) {
+			for (c = 0; c < num_cars; ++c) {
+				hist_merge(&all, &elevator.cars[c].latency.by_type[k][t]);
+			}
+		}
+		latency_show_hist(m, kinds[k], "all", &all);
 
-/* Module initialization */
-static int elevator_init(void) {  
+		for (t = NUM_TYPES - 1; t >= 0; --t) {
+			memset(&h, 0, sizeof(h));
+			for (c = 0; c < num_cars; ++c) {
+				hist_merge(&h, &elevator.cars[c].latency.by_type[k][t]);
+			}
+			latency_show_hist(m, kinds[k], types[t], &h);
+		}
 
-	/* Allocate buffer for proc fs */
-	procfs_buffer = kmalloc(PROC_SIZE, __GFP_RECLAIM); 
-	if (procfs_buffer == NULL) {
-		return -ENOMEM;
+		for (i = 0; i < num_floors; ++i) {
+			memset(&h, 0, sizeof(h));
+			for (c = 0; c < num_cars; ++c) {
+				hist_merge(&h, &elevator.cars[c].latency.by_floor[k][i]);
+			}
+			snprintf(label, sizeof(label), "floor %d", i + 1);
+			latency_show_hist(m, kinds[k], label, &h);
+		}
 	}
+	return 0;
+}
 
-	/* Initialize elevator */
-	elevator.state = OFFLINE;	
-	mutex_init(&elevator.mutex);
+static int latency_open(struct inode *inode, struct file *file) {
+	return single_open(file, latency_show, NULL);
+}
 
-	/* Initializing proc fs */    
-	proc_file = proc_create(PROC_NAME, PROC_PERMS, PROC_PARENT, &proc_fops);
-	if (proc_file == NULL) {			
-		printk(KERN_ALERT "Elevator: %s: Error: Could not initialize 
-			/proc/%s\n", __FUNCTION__, PROC_NAME);
-		remove_proc_entry(PROC_NAME, PROC_PARENT); 
+/* create the Passenger slab cache and fill the pool from it */
+static int passenger_pool_init(void) {
+	Passenger *p;
+	int i;
+
+	passenger_cache = kmem_cache_create("elevator_passenger", 
+			sizeof(Passenger), 0, SLAB_HWCACHE_ALIGN, NULL);
+	if (passenger_cache == NULL) {
 		return -ENOMEM;
 	}
-	printk(KERN_INFO "Elevator: %s: /proc/%s created\n", __FUNCTION__, PROC_NAME);
 
-    STUB_start_elevator = my_start_elevator;
-    STUB_issue_request = my_issue_request;
-    STUB_stop_elevator = my_stop_elevator;
+	spin_lock_init(&passenger_pool.lock);
+	INIT_LIST_HEAD(&passenger_pool.free);
+	passenger_pool.num_free = 0;
+	passenger_pool.hits = 0;
+	passenger_pool.misses = 0;
 
-    return 0;
+	for (i = 0; i < PASSENGER_POOL_SIZE; ++i) {
+		p = kmem_cache_alloc(passenger_cache, GFP_KERNEL);
+		if (p == NULL) {
+			break; /* a smaller pool still works */
+		}
+		list_add(&p->list, &passenger_pool.free);
+		passenger_pool.num_free += 1;
+	}
+	return 0;
 }
-module_init(elevator_init);
-
-/* Module exiting */
-static void elevator_exit(void) {
-    STUB_start_elevator = NULL;
-    STUB_issue_request = NULL;
-    STUB_stop_elevator = NULL;
 
-    /* Cleaning proc fs */
-    remove_proc_entry(PROC_NAME, NULL);
-	printk(KERN_INFO "Elevator: %s: /proc/%s removed\n",  __FUNCTION__, PROC_NAME);
+/* return every pooled object to the cache and destroy it */
+static void passenger_pool_destroy(void) {
+	struct list_head *temp;
+	struct list_head *dummy; 
+	Passenger *p;
 
-	/* deactivate elevator */
-	if (elevator.state != OFFLINE) {
-		elevator_deactivate();
+	list_for_each_safe(temp, dummy, &passenger_pool.free) { 
+		p = list_entry(temp, Passenger, list);
+		list_del(temp);
+		kmem_cache_free(passenger_cache, p);
 	}
-
-	mutex_destroy(&elevator.mutex);
-	kfree(procfs_buffer);
+	passenger_pool.num_free = 0;
+	kmem_cache_destroy(passenger_cache);
 }
-module_exit(elevator_exit);
 
-/* Implements start_elevator() system call */
-long my_start_elevator(void) {
-	int err;
+/* allocate a Passenger, from the pool if possible. May sleep on a pool 
+miss, so it must not be called with a floor lock held. */
+static Passenger *alloc_passenger(void) {
+	Passenger *p;
 
-    printk(KERN_NOTICE "Elevator: %s\n", __FUNCTION__);
+	p = NULL;
+	spin_lock(&passenger_pool.lock);
+	if (!list_empty(&passenger_pool.free)) {
+		p = list_first_entry(&passenger_pool.free, Passenger, list);
+		list_del(&p->list);
+		passenger_pool.num_free -= 1;
+		passenger_pool.hits += 1;
+	} else {
+		passenger_pool.misses += 1;
+	}
+	spin_unlock(&passenger_pool.lock);
 
-	mutex_lock(&elevator.mutex);	
-	err = elevator.state == OFFLINE ? 0 : 1; /* check if elevator already running */
-	mutex_unlock(&elevator.mutex);
+	if (p == NULL) {
+		p = kmem_cache_alloc(passenger_cache, GFP_KERNEL);
+	}
+	return p;
+}
 
-	if (!err) {
-		err = elevator_activate();
+/* give a Passenger back to the pool, or to the cache if the pool is full */
+static void free_passenger(Passenger *p) {
+	atomic_dec(&elevator.live); /* taken by admit() */
+	spin_lock(&passenger_pool.lock);
+	if (passenger_pool.num_free < PASSENGER_POOL_SIZE) {
+		list_add(&p->list, &passenger_pool.free);
+		passenger_pool.num_free += 1;
+		p = NULL;
 	}
+	spin_unlock(&passenger_pool.lock);
 
-	return err;
+	if (p != NULL) {
+		kmem_cache_free(passenger_cache, p);
+	}
 }
 
-/* Implements issue_request() system call */
-long my_issue_request(int start_floor, int destination_floor, int type) {
-    int err;
+/* Delivery events. Each reader of /dev/elevator gets its own ring of 
+struct elevator_event and sees every board and deliver from the moment 
+it opened the device, so producers learn about completions without 
+re-reading /proc under the bank lock. Cars publish under car->mutex (and 
+a floor lock when boarding) and take events_lock inside them. A reader 
+that falls behind loses the newest events; it is told how many by an 
+ELEVATOR_EVENT_LOST entry once there is room again. The outcome of a 
+file's own writes goes to its ring too (see dev_write()). */
+#define EVENT_RING_SIZE 1024 /* per reader, a power of two */
+
+typedef struct Subscriber {
+	struct list_head list; /* on subscribers, under events_lock */
+	wait_queue_head_t wait;
+	unsigned int head; /* next slot written, under events_lock */
+	unsigned int tail; /* next slot read, under events_lock */
+	u32 lost; /* events dropped since the last LOST entry */
+	u32 mask; /* kinds wanted, 1 << ELEVATOR_EVENT_* */
+	struct elevator_event ring[EVENT_RING_SIZE];
+} Subscriber;
+
+static LIST_HEAD(subscribers);
+static DEFINE_SPINLOCK(events_lock);
+static atomic_t num_subscribers; /* lets cars skip the lock when unwatched */
+static atomic_t passenger_ids;
+
+/* append ev to one reader's ring (events_lock held) */
+static void push_event(Subscriber *sub, const struct elevator_event *ev) {
+	struct elevator_event *slot;
+
+	if (sub->lost > 0 && sub->head - sub->tail < EVENT_RING_SIZE) {
+		slot = &sub->ring[sub->head++ % EVENT_RING_SIZE];
+		memset(slot, 0, sizeof(*slot));
+		slot->kind = ELEVATOR_EVENT_LOST;
+		slot->id = sub->lost;
+		slot->time_ns = ev->time_ns;
+		sub->lost = 0;
+	}
+	if (sub->head - sub->tail >= EVENT_RING_SIZE) {
+		sub->lost += 1;
+		return;
+	}
+	sub->ring[sub->head++ % EVENT_RING_SIZE] = *ev;
+}
 
-	printk(KERN_NOTICE "Elevator: %s\n", __FUNCTION__);
+/* tell every reader that p boarded or got off car at floor */
+static void publish_event(Car *car, Passenger *p, int kind, int floor) {
+	struct elevator_event ev;
+	Subscriber *sub;
 
-	mutex_lock(&elevator.mutex);
-	err = (is_active()) ? 0 : 1; /* check if elevator running */
-	mutex_unlock(&elevator.mutex);
-	
-	if (err) {
-		return 1;
+	if (atomic_read(&num_subscribers) == 0) {
+		return;
 	}
-	/* validate request */
-	if (start_floor < LOBBY || start_floor > NUM_FLOORS || 
-			destination_floor < LOBBY || destination_floor > NUM_FLOORS || 
-			!(type == GRAPE || type == WOLF || type == SHEEP)) {
-		return 1;
+	memset(&ev, 0, sizeof(ev));
+	ev.id = p->id;
+	ev.kind = kind;
+	ev.car = car->id;
+	ev.floor = floor;
+	ev.time_ns = ktime_to_ns(ktime_get());
+
+	spin_lock(&events_lock);
+	list_for_each_entry(sub, &subscribers, list) {
+		if (sub->mask & BIT(kind)) {
+			push_event(sub, &ev);
+			wake_up_interruptible(&sub->wait);
+		}
 	}
-	/* add passenger at the corresponding floor */
-	return add_passenger(start_floor, destination_floor, type);
+	spin_unlock(&events_lock);
 }
 
-/* Implements stop_elevator() system call */
-long my_stop_elevator(void) {
-	long err;
-    printk(KERN_NOTICE "Elevator: %s\n", __FUNCTION__);
-
-	mutex_lock(&elevator.mutex);
-	/* check if elevator already stopped */
-	err = (elevator.state == OFFLINE || elevator.deactivating) ? 1 : 0;	
-	mutex_unlock(&elevator.mutex);	
+static int dev_open(struct inode *inode, struct file *file) {
+	Subscriber *sub;
 
-	if (!err) {
-		elevator_deactivate();		
+	sub = kvzalloc(sizeof(*sub), GFP_KERNEL);
+	if (sub == NULL) {
+		return -ENOMEM;
 	}
-	return err;    
+	init_waitqueue_head(&sub->wait);
+	sub->mask = ~0U;
+	file->private_data = sub;
+
+	spin_lock(&events_lock);
+	list_add_tail(&sub->list, &subscribers);
+	atomic_inc(&num_subscribers);
+	spin_unlock(&events_lock);
+	return 0;
 }
 
-/* elevator stop condition */
-static int can_stop(void) {
-	return kthread_should_stop() && elevator.num_of_passengers == 0;
+static int dev_release(struct inode *inode, struct file *file) {
+	Subscriber *sub = file->private_data;
+
+	spin_lock(&events_lock);
+	list_del(&sub->list);
+	atomic_dec(&num_subscribers);
+	spin_unlock(&events_lock);
+	kvfree(sub);
+	return 0;
 }
 
-/* find the nearest floor to which the waiting elevator should move */
-static int find_nearest_request(void) {
-	int i, elevator_floor, nearest_floor, nearest_distance, distance;
-	struct list_head *temp;	
-	Passenger *p;	
+static int events_pending(Subscriber *sub) {
+	return READ_ONCE(sub->head) != READ_ONCE(sub->tail);
+}
 
-	elevator_floor = elevator.current_floor;
-	nearest_floor = 0;
-	nearest_distance = NUM_FLOORS;
-	/* for each floor */
-	for (i = 1; i <= NUM_FLOORS; ++i) {		
-		/* for each passenger at the floor */
-		list_for_each(temp, &elevator.floors[i - 1].list) { 
-			p = list_entry(temp, Passenger, list);
-			/* find distance from elevator to the floor */
-			distance = i - elevator_floor;
-			if (distance < 0)
-				distance = -distance;
-			/* select the smallest distance */
-			if (nearest_floor == 0 || distance < nearest_distance) {
-				nearest_distance = distance;
-				nearest_floor = i;
+/* copy out as many whole events as fit; blocks for the first one unless 
+the file is non-blocking */
+static ssize_t dev_read(struct file *file, char __user *ubuf, size_t count, 
+loff_t *ppos) {
+	Subscriber *sub = file->private_data;
+	struct elevator_event ev;
+	size_t done;
+	int err;
+
+	if (count < sizeof(ev)) {
+		return -EINVAL;
+	}
+	done = 0;
+	while (done + sizeof(ev) <= count) {
+		spin_lock(&events_lock);
+		if (sub->head == sub->tail) {
+			spin_unlock(&events_lock);
+			if (done > 0) {
+				break;
+			}
+			if (file->f_flags & O_NONBLOCK) {
+				return -EAGAIN;
 			}
+			err = wait_event_interruptible(sub->wait, events_pending(sub));
+			if (err) {
+				return err;
+			}
+			continue;
 		}
-	}	
+		ev = sub->ring[sub->tail++ % EVENT_RING_SIZE];
+		spin_unlock(&events_lock);
 
-	return nearest_floor;
+		if (copy_to_user(ubuf + done, &ev, sizeof(ev))) {
+			return done > 0 ? done : -EFAULT;
+		}
+		done += sizeof(ev);
+	}
+	return done;
 }
 
-/*determine if an elevator can take a passenger on board  */
-static int can_load(int wolves, int sheep, int grapes, Passenger *p, int dir) {
-	if (elevator.num_of_passengers == CAPACITY)
-		return 0; /* no room */
-	if (p->type == SHEEP && wolves > 0)
-		return 0; /* a wolf on the board: a sheep cann't be loaded */
-	if (p->type == GRAPE && sheep > 0)
-		return 0;  /* a sheep on the board: a grape cann't be loaded */
-	/* The elevator does not take on board passengers who need to go 
-	the other direction. */
-	if (dir == UP && p->destination < elevator.current_floor)
-		return 0;
-	if (dir == DOWN && p->destination > elevator.current_floor)
+static __poll_t dev_poll(struct file *file, poll_table *wait) {
+	Subscriber *sub = file->private_data;
+
+	poll_wait(file, &sub->wait, wait);
+	return events_pending(sub) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+/* procfs open operation */
+static int proc_open(struct inode *inode, struct file *file) {
+	return seq_open(file, &proc_seq_ops);
+}
+
+/* returns 1 is elevator is active */
+static int is_active(void) {
+	if (READ_ONCE(elevator.state) == OFFLINE || READ_ONCE(elevator.deactivating)) {
 		return 0;
+	}
 	return 1;
 }
 
-/* Check if the elevator needs to stop to unload or load passengers.
- This will prevent unnecessary stops.
- However, the elevator may stop but not take passengers 
- if they are incompatible. */
-static int need_stop_on_floor(int floor, int direction) {
-	int result;
-	struct list_head *temp;
-	Passenger *p;	
+/* activates the elevator on start_elevator() syscall */
+static int elevator_activate(void) {
+	int i, c;
+	Car *car;
+
+	elevator_wq = alloc_workqueue("elevator", WQ_UNBOUND, 0);
+	if (elevator_wq == NULL) {
+		return -ENOMEM;
+	}
+	elevator.state = IDLE;	
+	elevator.deactivating = 0;
+	atomic_set(&elevator.dropped, 0);
+
+	for (c = 0; c < num_cars; ++c) {
+		car = &elevator.cars[c];
+		car->id = c + 1;
+		set_state(car, IDLE);
+		car->current_floor = LOBBY;
+		car->direction = UP;
+		car->target = LOBBY;
+		car->num_of_passengers = 0;
+		car->num_wolves = 0;
+		car->num_sheep = 0;
+		car->num_grapes = 0;
+		atomic_set(&car->num_waiting, 0);
+		ingress_init(&car->ingress);
+		elevator.serviced_base += car->num_serviced;
+		car->num_serviced = 0;
+		car->step = STEP_DECIDE;
+		car->dir = UP;
+		atomic_set(&car->idle, 0);
+		car->policy = selected_policy();
+
+		INIT_LIST_HEAD(&car->list);
+
+		/* init floors */
+		for (i = 1; i <= num_floors; ++i) {
+			spin_lock_init(&car->floors[i - 1].lock);
+			car->floors[i - 1].num_of_passengers = 0;
+			INIT_LIST_HEAD(&car->floors[i - 1].list);
+		}		
+		publish_stats(car);
+	}
 
-	result = 0;
+	/* set every car going */
+	atomic_set(&elevator.running, num_cars);
+	for (c = 0; c < num_cars; ++c) {
+		queue_delayed_work(elevator_wq, &elevator.cars[c].work, 0);
+	}
 
-	mutex_lock(&elevator.mutex);
+	return 0;
+}
 
-	/* check passengers on the current floor */
-	list_for_each(temp, &elevator.floors[floor - 1].list) { 
-		p = list_entry(temp, Passenger, list);
-		/* if the elevator goes up, then it picks up only those passengers 
-		who need to go up */
-		if (direction == UP && p->destination > floor) {
-			result = 1;
-			break;
-		}
-		/* if the elevator goes down, then it picks up only those passengers 
-		who need to go down */	
-		if (direction == DOWN && p->destination < floor) {
-			result = 1;
-			break;
-		}
-	} 	
+/* building ms until car has delivered everyone on the board. Nobody 
+boards while the bank stops, so the sweep only goes as far as the riders: 
+if someone gets off behind the car, on to the furthest floor getting off 
+ahead of it and back to the last one behind, else just to the furthest 
+one ahead; with a stop at each floor getting off (car->mutex held) */
+static u64 drain_estimate(Car *car) {
+	int curr, lo, hi, turn, dist, stops;
 
-	/* check passengers on the board */
-	list_for_each(temp, &elevator.list) { 
-		p = list_entry(temp, Passenger, list);	
-		if (p->destination == floor) {
-			result = 1;
-			break;
-		}
-	} 
+	if (car->num_of_passengers == 0) {
+		return 0; /* done at its next step */
+	}
+	lo = next_floor(car->getting_off, LOBBY);
+	hi = prev_floor(car->getting_off, num_floors);
+	curr = car->current_floor;
+	if (car->direction == UP) {
+		turn = max(curr, hi);
+		dist = lo >= curr ? hi - curr : (turn - curr) + (turn - lo);
+	} else {
+		turn = min(curr, lo);
+		dist = hi <= curr ? curr - lo : (curr - turn) + (hi - turn);
+	}
+	stops = bitmap_weight(car->getting_off, num_floors + 1);
+	return (u64)dist * READ_ONCE(floor_ms) + (u64)stops * READ_ONCE(load_ms);
+}
 
-	mutex_unlock(&elevator.mutex);
+/* tell the cars to stop, the idle ones at once and with STOP_FAST all of 
+them; a STOP_DRAIN under way can be turned into a STOP_FAST. Returns 1 if 
+the elevator is stopped or already stopping that way, else 0; 
+elevator_stopped() runs once the last car is done. */
+static int elevator_deactivate(int how) {
+	u64 eta, ms;
+	int c, riders;
+	Car *car;
+
+	down_write(&elevator.sem);
+	if (elevator.state == OFFLINE || elevator.deactivating >= how) {
+		up_write(&elevator.sem);
+		return 1;
+	}
+	elevator.deactivating = how;
+
+	eta = 0;
+	riders = 0;
+	for (c = 0; c < num_cars; ++c) {
+		car = &elevator.cars[c];
+		mutex_lock(&car->mutex);
+		riders += car->num_of_passengers;
+		ms = how == STOP_FAST ? 0 : drain_estimate(car);
+		mutex_unlock(&car->mutex);
+		eta = max(eta, ms);
+		/* under elevator.sem, so elevator_stopped() has not destroyed 
+		elevator_wq; a car that is done just returns */
+		if (how == STOP_FAST) {
+			atomic_set(&car->idle, 0);
+			mod_delayed_work(elevator_wq, &car->work, 0);
+		} else {
+			car_wake(car);
+		}
+	}
+	elevator.drain_end = ktime_add_ms(ktime_get(), 
+		div64_u64(eta, READ_ONCE(time_compression)));
+	up_write(&elevator.sem);
 
-	return result;
+	if (how == STOP_FAST) {
+		printk(KERN_NOTICE "Elevator: fast stop, %d riders put off at the "
+			"next floor\n", riders);
+	} else {
+		printk(KERN_NOTICE "Elevator: stopping, %d riders to deliver in "
+			"about %llu s of building time\n", riders, 
+			div64_u64(eta, 1000));
+	}
+	return 0;
 }
 
-/* find the topmost floor, to which the elevator moving up should rise. */
-static int find_upper_bound(void) {
-	int i, upper_floor;
+/* work run once every car is done: the elevator is stopped now */
+static void elevator_stopped(struct work_struct *work) {
+	int i;
+	int c;
 	struct list_head *temp;
+	struct list_head *dummy; 
 	Passenger *p;	
+	Car *car;
 
-	upper_floor = elevator.current_floor;
+	down_write(&elevator.sem);
+	/* nothing is queued on elevator_wq but steps of finished cars */
+	destroy_workqueue(elevator_wq);
+	elevator_wq = NULL;
 
-	mutex_lock(&elevator.mutex);
+	/* Clean up lists*/
+	for (c = 0; c < num_cars; ++c) {
+		car = &elevator.cars[c];
+		set_state(car, OFFLINE);
+		drain_ingress(car);
+
+		/* cleanup floors */
+		for (i = 1; i <= num_floors; ++i) {		
+			list_for_each_safe(temp, dummy, &car->floors[i - 1].list) { 
+				p = list_entry(temp, Passenger, list);
+				list_del(temp);	
+				publish_event(car, p, ELEVATOR_EVENT_DROP, i);
+				/* counted out one by one: a producer between admit() 
+				and queueing still reconciles its own count */
+				leave_queue(p->start);
+				free_passenger(p);
+			} 
+			car->floors[i - 1].num_of_passengers = 0;
+			car->floors[i - 1].num_up = 0;
+			car->floors[i - 1].num_down = 0;
+			car->num_getting_off[i - 1] = 0;
+		}	
+		bitmap_zero(car->waiting_up, num_floors + 1);
+		bitmap_zero(car->waiting_down, num_floors + 1);
+		bitmap_zero(car->getting_off, num_floors + 1);
+		atomic_set(&car->num_waiting, 0);
 
-	/* check passengers on all floors above the current */
-	for (i = elevator.current_floor; i <= NUM_FLOORS; ++i) {	
-		/* for each passenger at the floor */	
-		list_for_each(temp, &elevator.floors[i - 1].list) { 
+		/* cleanup car */
+		list_for_each_safe(temp, dummy, &car->list) { 
 			p = list_entry(temp, Passenger, list);
-			/* check start floor */
-			if (i > upper_floor) {
-				upper_floor = i;
-			}
-			/* check destination floor */
-			if (p->destination > upper_floor) {
-				upper_floor = p->destination;
-			}			
+			list_del(temp);	
+			free_passenger(p);
 		} 
-	}	
-
-	/* check passengers on the board */
-	list_for_each(temp, &elevator.list) { 
-		p = list_entry(temp, Passenger, list);	
-		/* check destination floor */
-		if (p->destination > upper_floor) {
-			upper_floor = p->destination;
-		}	
-	} 
+		publish_stats(car);
+	}
+	/* nobody waits anywhere now */
+	for (i = 0; i < num_floors; ++i) {
+		atomic_set(&stats_waiting[i], 0);
+	}
+	elevator.state = OFFLINE;	
+	stats_update();
+	up_write(&elevator.sem);
+	wake_up(&elevator.stopped);
+	printk(KERN_NOTICE "Elevator: stopped\n");
+}
 
-	mutex_unlock(&elevator.mutex);
+/* count a passenger in or out of the waiting figures of floor f and keep 
+the car's bitmaps in step (f->lock held) */
+static void count_waiting(Car *car, Floor *f, Passenger *p, int delta) {
+	int *num;
+	unsigned long *bits;
 
-	return upper_floor;
+	if (p->destination > p->start) {
+		num = &f->num_up;
+		bits = car->waiting_up;
+	} else {
+		num = &f->num_down;
+		bits = car->waiting_down;
+	}
+	f->num_of_passengers += delta;
+	atomic_add(delta, &stats_waiting[p->start - 1]);
+	*num += delta;
+	if (*num == 0) {
+		clear_bit(p->start, bits);
+	} else if (*num == delta) {
+		set_bit(p->start, bits);
+	}
 }
 
-/* find the lowest floor, to which the downward elevator should go down. */
-static int find_lower_bound(void) {
-	int i, lower_floor;
-	struct list_head *temp;
-	Passenger *p;	
+/* the same for a passenger getting on (delta 1) or off (-1) the car 
+(car->mutex held) */
+static void count_getting_off(Car *car, Passenger *p, int delta) {
+	int *num;
+
+	num = &car->num_getting_off[p->destination - 1];
+	*num += delta;
+	if (*num == 0) {
+		__clear_bit(p->destination, car->getting_off);
+	} else if (*num == delta) {
+		__set_bit(p->destination, car->getting_off);
+	}
+}
+
+/* move a waiting passenger from floor f onto the car (car->mutex and 
+f->lock held) */
+static void board_passenger(Car *car, Floor *f, Passenger *p) {
+	list_del(&p->list); /* delete the passenger from the floor */
+	/* add the passenger on the board */	
+	list_add_tail(&p->list, &car->list); 
+	/* update statistics */
+	car->num_of_passengers += 1; 
+	count_passenger(car, p->type, 1);
+	count_waiting(car, f, p, -1);
+	count_getting_off(car, p, 1);
+	leave_queue(p->start);
+	atomic_dec(&car->num_waiting);
+	p->boarded = ktime_get();
+	trace_elevator_board(car->id, p->start, p->destination, p->type, 
+		building_ms(p->boarded, p->enqueued));
+	publish_event(car, p, ELEVATOR_EVENT_BOARD, p->start);
+}
+
+/* Boarding optimiser. In FIFO order a wolf that boards ahead of a sheep 
+keeps the sheep off the car, as a sheep does a grape behind it. With 
+optimise_boarding set, the car boards the grapes, then the sheep, then the 
+wolves, so everyone the riders already on the board get along with gets 
+on. When that is more than the car has room for, the oldest go first; 
+passengers left behind count a skip, and once someone has max_skips they 
+board ahead of the rest. */
+static bool optimise_boarding;
+module_param(optimise_boarding, bool, 0644);
+MODULE_PARM_DESC(optimise_boarding, "board grapes, then sheep, then "
+	"wolves instead of in FIFO order");
+static unsigned int max_skips = 3;
+module_param(max_skips, uint, 0644);
+MODULE_PARM_DESC(max_skips, "stops the boarding optimiser may leave a "
+	"passenger behind before giving them priority");
+
+/* whether p may board as far as the direction (0 for any) and the 
+riders already on the board go, capacity aside */
+static int may_board(Car *car, Passenger *p, int dir) {
+	if (p->type == SHEEP && car->num_wolves > 0)
+		return 0;
+	if (p->type == GRAPE && car->num_sheep > 0)
+		return 0;
+	if (dir == UP && p->destination < car->current_floor)
+		return 0;
+	if (dir == DOWN && p->destination > car->current_floor)
+		return 0;
+	return 1;
+}
 
-	lower_floor = elevator.current_floor;
+/* board everyone who fits, grapes first and wolves last (car->mutex 
+held). The passengers to take are set aside before anyone boards, the 
+starved first and then the others in FIFO order; boarding a type never 
+turns away a type boarding after it. */
+static void board_optimised(Car *car, int floor, int dir) {
+	struct list_head *temp;
+	struct list_head *dummy; 
+	LIST_HEAD(picked);
+	int room, skips, pass, type;
+	RejectReason reason;
+	Passenger *p;
+	Floor *f;
 
-	mutex_lock(&elevator.mutex);
+	f = &car->floors[floor - 1];
+	room = capacity - car->num_of_passengers;
+	skips = READ_ONCE(max_skips);
 
-	/* check passengers on all floors below the current */
-	for (i = elevator.current_floor; i >= LOBBY; --i) {		
-		/* for each passenger at the floor */	
-		list_for_each(temp, &elevator.floors[i - 1].list) { 			
+	spin_lock(&f->lock);
+	for (pass = 0; pass < 2 && room > 0; ++pass) {
+		list_for_each_safe(temp, dummy, &f->list) { 		
 			p = list_entry(temp, Passenger, list);
-			/* check start floor */
-			if (i < lower_floor) {
-				lower_floor = i;
+			if (room > 0 && (pass == 1 || p->skips >= skips) && 
+					may_board(car, p, dir)) {
+				list_move_tail(&p->list, &picked);
+				room -= 1;
 			}
-			/* check destination floor */
-			if (p->destination < lower_floor) {
-				lower_floor = p->destination;
-			}			
-		} 
-	}	
+		}
+	}
 
-	/* check passengers on the board */
-	list_for_each(temp, &elevator.list) { 
+	/* whoever is left could not get on */
+	list_for_each(temp, &f->list) { 		
 		p = list_entry(temp, Passenger, list);
-		/* check destination floor */	
-		if (p->destination < lower_floor) {
-			lower_floor = p->destination;
-		}	
-	} 
-
-	mutex_unlock(&elevator.mutex);
+		if (!may_board(car, p, dir)) {
+			reason = board_check(car, p);
+			if (reason == REJECT_NONE) {
+				reason = REJECT_DIRECTION;
+			}
+		} else {
+			p->skips += 1;
+			reason = REJECT_CAPACITY;
+		}
+		trace_elevator_reject(car->id, floor, p->destination, p->type, 
+			reason);
+	}
 
-	return lower_floor;
+	for (type = GRAPE; type <= WOLF; ++type) {
+		list_for_each_safe(temp, dummy, &picked) { 		
+			p = list_entry(temp, Passenger, list);
+			if (p->type == type) {
+				board_passenger(car, f, p);
+			}
+		}
+	}
+	spin_unlock(&f->lock);
 }
 
-/* loading passengers operation */
-static void loading(int floor, int dir) {	
-	/* first unload */
-	mutex_lock(&elevator.mutex);			
-	elevator.state = LOADING;	
-	elevator_unload(floor);		
-	mutex_unlock(&elevator.mutex);	
+/* car loads passengers on the current floor (called with car->mutex held) */
+static void elevator_load(Car *car, int floor, int dir) {
+	struct list_head *temp;
+	struct list_head *dummy; 
+	RejectReason reason;
+	Passenger *p;
 
-	ssleep(1.0);
+	if (READ_ONCE(optimise_boarding)) {
+		board_optimised(car, floor, dir);
+		return;
+	}
 
-	/* then load */
-	mutex_lock(&elevator.mutex);
-	/* load passengers in the active state only */
-	if (is_active()) {
-		elevator_load(floor, dir);
-	} 
-	mutex_unlock(&elevator.mutex);
+	spin_lock(&car->floors[floor - 1].lock);
+	/* for each passenger on current floor */
+	list_for_each_safe(temp, dummy, &car->floors[floor - 1].list) { 		
+		p = list_entry(temp, Passenger, list);
+		/* check if current passenger can be loaded */
+		reason = load_check(car, p, dir);
+		if (reason == REJECT_NONE) {
+			board_passenger(car, &car->floors[floor - 1], p);
+		} else {
+			trace_elevator_reject(car->id, floor, p->destination, p->type, 
+				reason);
+		}		
+	}
+	spin_unlock(&car->floors[floor - 1].lock);
 }
 
-/* waiting for a passenger request while there are no passengers on the 
-board or on the floors. */
-static int wait_idle(void) {
-	int nearest_floor;
+/* car unloads passengers on the floor (called with car->mutex held) */
+static void elevator_unload(Car *car, int floor) {
+	struct list_head *temp;
+	struct list_head *dummy; 
+	Passenger *p;	
+
+	/* for each passenger on the board */
+	list_for_each_safe(temp, dummy, &car->list) { 
+		p = list_entry(temp, Passenger, list);
+		/* check if current floor is passenger's destination */
+		if (p->destination == floor) {
+			/* delete the passenger from the elevator */
+			list_del(temp);	
+			/* update statistics */
+			car->num_of_passengers -= 1;
+			count_passenger(car, p->type, -1);
+			count_getting_off(car, p, -1);
+			record_latency(car, p);
+			publish_event(car, p, ELEVATOR_EVENT_DELIVER, floor);
+			free_passenger(p);
+			car->num_serviced += 1;
+		}		
+	}
+}
 
-	mutex_lock(&elevator.mutex);
-	/* it returns 0 if no waiting passengers */
-	nearest_floor = find_nearest_request(); 
-	/* waits until a waiting passenger appears */
-	while (!can_stop() && nearest_floor == 0) {
-		elevator.state = IDLE;
-		mutex_unlock(&elevator.mutex);
-		ssleep(1.0); /* sleep 1 seconds and then check again */
-		mutex_lock(&elevator.mutex);
-		nearest_floor = find_nearest_request();
+/* estimated building ms until car can pick up passenger p, following the 
+car's current sweep: the distance to the start floor if it is ahead in 
+the car's direction (and the passenger goes the same way), otherwise the 
+distance to the turning point and back. Each queued passenger is counted 
+as one extra stop. The car is read without its lock: a slightly stale 
+view only makes the estimate slightly worse. */
+static u64 estimate_pickup(Car *car, Passenger *p) {
+	int cur, dir, turn, target, distance, queued, stops;
+
+	cur = READ_ONCE(car->current_floor);
+	target = READ_ONCE(car->target);
+	queued = READ_ONCE(car->num_of_passengers) + atomic_read(&car->num_waiting);
+	dir = p->destination > p->start ? UP : DOWN;
+
+	if (queued == 0) {
+		/* idle car goes straight there */
+		distance = abs(p->start - cur);
+	} else if (READ_ONCE(car->direction) == UP) {
+		if (dir == UP && p->start >= cur) {
+			distance = p->start - cur;
+		} else {
+			turn = max3(target, p->start, cur);
+			distance = (turn - cur) + (turn - p->start);
+		}
+	} else {
+		if (dir == DOWN && p->start <= cur) {
+			distance = cur - p->start;
+		} else {
+			turn = min3(target, p->start, cur);
+			distance = (cur - turn) + (p->start - turn);
+		}
 	}
-	mutex_unlock(&elevator.mutex);
-	return can_stop() ? 0 : nearest_floor;
+
+	/* in u64: 1000 floors of a writable floor_ms overflow an int */
+	stops = min(queued, distance + 1);
+	return (u64)distance * READ_ONCE(floor_ms) + 
+		(u64)stops * READ_ONCE(load_ms);
 }
 
-/* elevator routine */
-static int elevator_run(void *data) {
-	int dir, vel, next, curr;
-	struct thread_parameter *parm;
-	
-	parm = data; 
+/* dispatcher: pick the car with the best estimated pickup time */
+static Car *dispatch_passenger(Passenger *p) {
+	u64 best_time, time;
+	Car *best;
+	int c;
+
+	best = &elevator.cars[0];
+	best_time = estimate_pickup(best, p);
+	for (c = 1; c < num_cars; ++c) {
+		time = estimate_pickup(&elevator.cars[c], p);
+		if (time < best_time) {
+			best_time = time;
+			best = &elevator.cars[c];
+		}
+	}
+	return best;
+}
 
-	dir = UP;
-	vel = 1;	
+/* put passenger on its start floor list of the car; only that floor's 
+lock is taken */
+static void floor_add(Car *car, Passenger *p) {
+	Floor *floor;
+
+	floor = &car->floors[p->start - 1];
+	spin_lock(&floor->lock);
+	/* insert passenger to the start floor list in FIFO order */	
+	list_add_tail(&p->list, &floor->list);
+	/* update statistics */
+	count_waiting(car, floor, p, 1);
+	spin_unlock(&floor->lock);
+}
 
-	/* starting from IDLE state */
+/* hand a passenger to the car (called with elevator.sem held for reading). 
+It goes through the ingress ring and reaches the floor list when the 
+car's car_step() drains it; if the ring is full the passenger is put on the floor 
+list directly, which costs a floor spinlock but never sleeps. */
+static void enqueue_passenger(Car *car, Passenger *p) {
+	trace_elevator_enqueue(car->id, p->start, p->destination, p->type);
+	record_demand(p->start);
+	/* counted first so the car never sees more boarded than waiting */
+	atomic_inc(&car->num_waiting);
+	if (!ingress_push(&car->ingress, p)) {
+		/* full: move the ring's passengers to their floors first, so p 
+		goes on its floor list behind everyone queued before it */
+		atomic_inc(&car->ingress.overflows);
+		spin_lock(&car->ingress.lock);
+		drain_ingress_locked(car);
+		floor_add(car, p);
+		spin_unlock(&car->ingress.lock);
+	}
+}
 
-	/* waits until a waiting passenger appears */
-	next = wait_idle(); 
-	
-	while (!can_stop()) {	
-		/* the LOOK algorithm */		
-		curr = elevator.current_floor;		
-		while (!can_stop()) {
-			/* check if need stop at the current floor */
-			if (need_stop_on_floor(curr, dir)) {
-				/* unload and load passengers */
-				loading(curr, dir); /* state = LOADING */
-				/* recalculate lower or upper bound */
-				if (dir == UP) {
-					next = find_upper_bound();
-				} else {
-					next = find_lower_bound();
-				}
-			}
+static void ingress_init(IngressRing *ring) {
+	unsigned int i;
 
-			mutex_lock(&elevator.mutex);			
-			elevator.state = dir; /* state = UP or DOWN */
-			mutex_unlock(&elevator.mutex);
-
-			if (curr == next) {
-				break; /* change direction needed */
-			}			
-			
-			/* moving */			
-			ssleep(2.0);
-
-			mutex_lock(&elevator.mutex);	
-			/* update elevator floor */		
-			elevator.current_floor += vel;
-			curr = elevator.current_floor;
-			mutex_unlock(&elevator.mutex);
-		}		
+	atomic_set(&ring->head, 0);
+	ring->tail = 0;
+	atomic_set(&ring->overflows, 0);
+	spin_lock_init(&ring->lock);
+	for (i = 0; i < INGRESS_RING_SIZE; ++i) {
+		ring->slots[i].seq = i;
+		ring->slots[i].passenger = NULL;
+	}
+}
 
-		
-		if (elevator.num_of_passengers > 0) {
-			/* if there are passengers on board */
-			
-			/* change direction */
-			if (dir == UP) {
-				dir = DOWN;			
-				next = find_lower_bound();
-				vel = -1;
-			} else {
-				dir = UP;			
-				next = find_upper_bound();
-				vel = 1;
+/* producer side: returns 0 if the ring is full */
+static int ingress_push(IngressRing *ring, Passenger *p) {
+	IngressSlot *slot;
+	unsigned int pos, seq;
+	int diff;
+
+	pos = atomic_read(&ring->head);
+	for (;;) {
+		slot = &ring->slots[pos & (INGRESS_RING_SIZE - 1)];
+		seq = smp_load_acquire(&slot->seq);
+		diff = (int)(seq - pos);
+		if (diff == 0) {
+			/* slot free for this position: try to claim it */
+			if (atomic_cmpxchg(&ring->head, pos, pos + 1) == (int)pos) {
+				break;
 			}
+			pos = atomic_read(&ring->head);
+		} else if (diff < 0) {
+			return 0; /* the consumer has not freed this slot yet */
 		} else {
-			/* if no passengers on the board */
+			pos = atomic_read(&ring->head); /* another producer won */
+		}
+	}
+
+	slot->passenger = p;
+	smp_store_release(&slot->seq, pos + 1); /* publish */
+	return 1;
+}
+
+/* consumer side (car_step() only): returns NULL if the ring is empty */
+static Passenger *ingress_pop(IngressRing *ring) {
+	IngressSlot *slot;
+	Passenger *p;
+	unsigned int pos;
+
+	pos = ring->tail;
+	slot = &ring->slots[pos & (INGRESS_RING_SIZE - 1)];
+	if ((int)(smp_load_acquire(&slot->seq) - (pos + 1)) < 0) {
+		return NULL; /* not published yet */
+	}
+
+	p = slot->passenger;
+	/* free the slot for the position one lap ahead */
+	smp_store_release(&slot->seq, pos + INGRESS_RING_SIZE);
+	WRITE_ONCE(ring->tail, pos + 1);
+	return p;
+}
+
+/* move everything queued in the car's ingress ring to the floor lists, 
+in order (car->ingress.lock held) */
+static void drain_ingress_locked(Car *car) {
+	Passenger *p;
+
+	while ((p = ingress_pop(&car->ingress)) != NULL) {
+		floor_add(car, p);
+	}
+}
+
+/* move everything queued in the car's ingress ring to the floor lists */
+static void drain_ingress(Car *car) {
+	spin_lock(&car->ingress.lock);
+	drain_ingress_locked(car);
+	spin_unlock(&car->ingress.lock);
+}
+
+/* reserve a place for a new passenger starting at floor: 0, or -EBUSY 
+or -EAGAIN if a limit would be exceeded (see max_waiting) */
+static int admit(int floor) {
+	unsigned int budget, waiting, per_floor;
+	atomic_t *at_floor;
+	int err;
+
+	budget = READ_ONCE(passenger_budget_kb);
+	waiting = READ_ONCE(max_waiting);
+	per_floor = READ_ONCE(max_waiting_per_floor);
+	at_floor = &elevator.floor_waiting[floor - 1];
+
+	/* reserve first, so racing producers cannot all squeeze in */
+	err = 0;
+	if (budget > 0 && atomic_inc_return(&elevator.live) > 
+			(u64)budget * 1024 / sizeof(Passenger)) {
+		atomic_inc(&elevator.shed_memory);
+		err = -EBUSY;
+	} else if (budget == 0) {
+		atomic_inc(&elevator.live);
+	}
+	if (atomic_inc_return(&elevator.waiting) > waiting && waiting > 0 && 
+			err == 0) {
+		atomic_inc(&elevator.shed_waiting);
+		err = -EAGAIN;
+	}
+	if (atomic_inc_return(at_floor) > per_floor && per_floor > 0 && 
+			err == 0) {
+		atomic_inc(&elevator.shed_floor);
+		err = -EAGAIN;
+	}
+
+	if (err != 0) {
+		leave_queue(floor);
+		atomic_dec(&elevator.live);
+	}
+	return err;
+}
+
+/* the passenger starting at floor is no longer waiting */
+static void leave_queue(int floor) {
+	atomic_dec(&elevator.waiting);
+	atomic_dec(&elevator.floor_waiting[floor - 1]);
+}
+
+/* add passenger at the floor (by issue_request() */
+static long add_passenger(int start_floor, int dest_floor, PassengerType type) {
+	Passenger *p;
+	Car *car;
+	long result;
+
+	result = 1;
+	car = NULL;
+
+	result = admit(start_floor);
+	if (result != 0) {
+		return result;
+	}
+	result = 1;
+
+	/* Allocate a new linked list item before taking the lock */
+	p = alloc_passenger();
+	if (p == NULL) {
+		leave_queue(start_floor);
+		atomic_dec(&elevator.live);
+		return -ENOMEM;
+	}
+
+	p->start = start_floor;
+	p->destination = dest_floor;	
+	p->type = type;		
+	p->id = atomic_inc_return(&passenger_ids);
+	p->enqueued = ktime_get();
+	p->skips = 0;
+
+	/* producers never sleep here: if start/stop holds the bank lock, the 
+	elevator is not accepting passengers anyway */
+	if (down_read_trylock(&elevator.sem)) {
+		if (elevator.state != OFFLINE && elevator.deactivating == 0) {
+			car = dispatch_passenger(p);
+			enqueue_passenger(car, p);
+			/* the bank lock keeps the car's work alive */
+			car_wake(car);
+			result = 0;
+		}
+		up_read(&elevator.sem);
+	}
+
+	if (result != 0) {
+		leave_queue(start_floor);
+		free_passenger(p);
+	}
+
+	return result;
+}
+
+/* add a batch of passengers (by issue_request_batch()). Requests are 
+validated and allocated outside the lock and then dispatched onto the 
+floor lists under a single acquisition of elevator.sem. Each entry's 
+status is filled in; returns the number of passengers queued. */
+static long add_passengers(struct elevator_request *reqs, int count) {
+	LIST_HEAD(batch);
+	struct list_head *temp;
+	struct list_head *dummy; 
+	Passenger *p;
+	ktime_t now;
+	long queued;
+	int i, c, active, err;
+
+	/* validate and allocate in one pass */
+	now = ktime_get();
+	queued = 0;
+	for (i = 0; i < count; ++i) {
+		if (!is_valid_request(reqs[i].start, reqs[i].dest, reqs[i].type)) {
+			reqs[i].status = 1;
+			continue;
+		}
+		err = admit(reqs[i].start);
+		if (err != 0) {
+			reqs[i].status = err;
+			continue;
+		}
+		p = alloc_passenger();
+		if (p == NULL) {
+			leave_queue(reqs[i].start);
+			atomic_dec(&elevator.live);
+			reqs[i].status = -ENOMEM;
+			continue;
+		}
+		p->start = reqs[i].start;
+		p->destination = reqs[i].dest;
+		p->type = reqs[i].type;
+		p->id = atomic_inc_return(&passenger_ids);
+		p->enqueued = now;
+		p->skips = 0;
+		/* FIFO order within the batch is preserved */
+		list_add_tail(&p->list, &batch);
+		reqs[i].status = 0;
+		reqs[i].id = p->id;
+		queued += 1;
+	}
 
-			/* find the nearest request */
-			next = wait_idle();
-			if (next == 0) {
-				break; /* stopped by syscall */
+	active = 0;
+	if (down_read_trylock(&elevator.sem)) {
+		active = is_active();
+		if (active) {
+			list_for_each_safe(temp, dummy, &batch) { 
+				p = list_entry(temp, Passenger, list);
+				list_del(temp);
+				enqueue_passenger(dispatch_passenger(p), p);
 			}
-			/* check if change direction needed */
-			if (next == elevator.current_floor) {
-				next = find_upper_bound();
-				if (next == elevator.current_floor) {
-					next = find_lower_bound();
-				}
+			/* wake the cars that are idle */
+			for (c = 0; queued > 0 && c < num_cars; ++c) {
+				car_wake(&elevator.cars[c]);
 			}
+		}
+		up_read(&elevator.sem);
+	}
 
-			if (dir == UP && next < elevator.current_floor) {
-				dir = DOWN;				
-				vel = -1;
-			} else if (dir == DOWN && next > elevator.current_floor) {
-				dir = UP;				
-				vel = 1;
+	if (!active) {
+		/* stopped in the meantime: nothing was queued */
+		list_for_each_safe(temp, dummy, &batch) { 
+			p = list_entry(temp, Passenger, list);
+			list_del(temp);
+			leave_queue(p->start);
+			free_passenger(p);
+		}
+		for (i = 0; i < count; ++i) {
+			if (reqs[i].status == 0) {
+				reqs[i].status = 1;
 			}
-		}		
-	}	
+		}
+		return 0;
+	}
+	return queued;
+}
+
+/* Initialization and clean-up */
+
+/* allocate the per-floor parts of a car; car_free() undoes it, also 
+after a partial failure */
+static int car_alloc(Car *car) {
+	int k, longs;
+
+	longs = BITS_TO_LONGS(num_floors + 1);
+	car->floors = kcalloc(num_floors, sizeof(Floor), GFP_KERNEL);
+	car->waiting_up = kcalloc(longs, sizeof(long), GFP_KERNEL);
+	car->waiting_down = kcalloc(longs, sizeof(long), GFP_KERNEL);
+	car->getting_off = kcalloc(longs, sizeof(long), GFP_KERNEL);
+	car->num_getting_off = kcalloc(num_floors, sizeof(int), GFP_KERNEL);
+	if (car->floors == NULL || car->waiting_up == NULL || 
+			car->waiting_down == NULL || car->getting_off == NULL || 
+			car->num_getting_off == NULL) {
+		return -ENOMEM;
+	}
+	for (k = 0; k < NUM_LATENCIES; ++k) {
+		car->latency.by_floor[k] = kvcalloc(num_floors, sizeof(Histogram), 
+			GFP_KERNEL);
+		if (car->latency.by_floor[k] == NULL) {
+			return -ENOMEM;
+		}
+	}
 	return 0;
 }
+
+static void car_free(Car *car) {
+	int k;
+
+	for (k = 0; k < NUM_LATENCIES; ++k) {
+		kvfree(car->latency.by_floor[k]);
+	}
+	kfree(car->num_getting_off);
+	kfree(car->getting_off);
+	kfree(car->waiting_down);
+	kfree(car->waiting_up);
+	kfree(car->floors);
+}
+
+/* free the cars and everything they own */
+static void cars_free(void) {
+	int c;
+
+	for (c = 0; c < num_cars; ++c) {
+		car_free(&elevator.cars[c]);
+	}
+	kfree(elevator.cars);
+}
+
+/* Module initialization */
+static int elevator_init(void) {  
+	int c;
+
+	if (num_cars < 1 || num_cars > MAX_CARS) {
+		printk(KERN_ALERT "Elevator: %s: num_cars must be between 1 and %d\n", 
+			__FUNCTION__, MAX_CARS);
+		return -EINVAL;
+	}
+	if (num_floors < 2 || num_floors > MAX_FLOORS) {
+		printk(KERN_ALERT "Elevator: %s: num_floors must be between 2 and %d\n", 
+			__FUNCTION__, MAX_FLOORS);
+		return -EINVAL;
+	}
+	if (capacity < 1 || capacity > MAX_CAPACITY) {
+		printk(KERN_ALERT "Elevator: %s: capacity must be between 1 and %d\n", 
+			__FUNCTION__, MAX_CAPACITY);
+		return -EINVAL;
+	}
+
+	/* Passenger slab cache and pool */
+	if (passenger_pool_init() != 0) {
+		return -ENOMEM;
+	}
+
+	/* Initialize elevator */
+	elevator.cars = kcalloc(num_cars, sizeof(Car), GFP_KERNEL);
+	if (elevator.cars == NULL) {
+		passenger_pool_destroy();
+		return -ENOMEM;
+	}
+	for (c = 0; c < num_cars; ++c) {
+		if (car_alloc(&elevator.cars[c]) != 0) {
+			cars_free();
+			passenger_pool_destroy();
+			return -ENOMEM;
+		}
+	}
+	if (stats_init() != 0) {
+		cars_free();
+		passenger_pool_destroy();
+		return -ENOMEM;
+	}
+	elevator.floor_waiting = kcalloc(num_floors, sizeof(atomic_t), GFP_KERNEL);
+	if (elevator.floor_waiting == NULL || demand_init() != 0) {
+		kfree(elevator.floor_waiting);
+		free_pages_exact(stats_page, stats_size);
+		cars_free();
+		passenger_pool_destroy();
+		return -ENOMEM;
+	}
+	for (c = 0; c < num_cars; ++c) {
+		elevator.cars[c].id = c + 1;
+		elevator.cars[c].state = OFFLINE;
+		elevator.cars[c].current_floor = LOBBY;
+		mutex_init(&elevator.cars[c].mutex);
+		INIT_DELAYED_WORK(&elevator.cars[c].work, car_step);
+		elevator.cars[c].policy = selected_policy();
+		seqcount_init(&elevator.cars[c].stats_seq);
+	}
+	/* publish only once every car and its seqcount is initialised */
+	for (c = 0; c < num_cars; ++c) {
+		publish_stats(&elevator.cars[c]);
+	}
+	elevator.state = OFFLINE;	
+	init_rwsem(&elevator.sem);
+	init_waitqueue_head(&elevator.stopped);
+	INIT_DELAYED_WORK(&elevator.stop_work, elevator_stopped);
+	building_epoch = ktime_get();
+
+	/* Initializing proc fs */    
+	proc_file = proc_create(PROC_NAME, PROC_PERMS, PROC_PARENT, &proc_fops);
+	if (proc_file == NULL) {			
+		printk(KERN_ALERT "Elevator: %s: Error: Could not initialize "
+			"/proc/%s\n", __FUNCTION__, PROC_NAME);
+		remove_proc_entry(PROC_NAME, PROC_PARENT); 
+		kfree(demand.arrivals);
+		kfree(elevator.floor_waiting);
+		free_pages_exact(stats_page, stats_size);
+		cars_free();
+		passenger_pool_destroy();
+		return -ENOMEM;
+	}
+	printk(KERN_INFO "Elevator: %s: /proc/%s created\n", __FUNCTION__, PROC_NAME);
+
+	stats_proc_file = proc_create(STATS_PROC_NAME, STATS_PROC_PERMS, 
+		PROC_PARENT, &stats_fops);
+	if (stats_proc_file == NULL) {
+		printk(KERN_ALERT "Elevator: %s: Error: Could not initialize "
+			"/proc/%s\n", __FUNCTION__, STATS_PROC_NAME);
+		remove_proc_entry(PROC_NAME, PROC_PARENT); 
+		kfree(demand.arrivals);
+		kfree(elevator.floor_waiting);
+		free_pages_exact(stats_page, stats_size);
+		cars_free();
+		passenger_pool_destroy();
+		return -ENOMEM;
+	}
+
+	latency_proc_file = proc_create(LATENCY_PROC_NAME, STATS_PROC_PERMS, 
+		PROC_PARENT, &latency_fops);
+	if (latency_proc_file == NULL) {
+		printk(KERN_ALERT "Elevator: %s: Error: Could not initialize "
+			"/proc/%s\n", __FUNCTION__, LATENCY_PROC_NAME);
+		remove_proc_entry(STATS_PROC_NAME, PROC_PARENT); 
+		remove_proc_entry(PROC_NAME, PROC_PARENT); 
+		kfree(demand.arrivals);
+		kfree(elevator.floor_waiting);
+		free_pages_exact(stats_page, stats_size);
+		cars_free();
+		passenger_pool_destroy();
+		return -ENOMEM;
+	}
+
+	if (misc_register(&elevator_dev) != 0) {
+		printk(KERN_ALERT "Elevator: %s: Error: Could not register "
+			"/dev/%s\n", __FUNCTION__, DEV_NAME);
+		remove_proc_entry(LATENCY_PROC_NAME, PROC_PARENT); 
+		remove_proc_entry(STATS_PROC_NAME, PROC_PARENT); 
+		remove_proc_entry(PROC_NAME, PROC_PARENT); 
+		kfree(demand.arrivals);
+		kfree(elevator.floor_waiting);
+		free_pages_exact(stats_page, stats_size);
+		cars_free();
+		passenger_pool_destroy();
+		return -ENOMEM;
+	}
+
+#ifdef ELEVATOR_SYSCALLS
+    STUB_start_elevator = my_start_elevator;
+    STUB_issue_request = my_issue_request;
+    STUB_stop_elevator = my_stop_elevator;
+    STUB_issue_request_batch = my_issue_request_batch;
+#endif
+
+    return 0;
+}
+module_init(elevator_init);
+
+/* Module exiting */
+static void elevator_exit(void) {
+	int c;
+
+#ifdef ELEVATOR_SYSCALLS
+    STUB_start_elevator = NULL;
+    STUB_issue_request = NULL;
+    STUB_stop_elevator = NULL;
+    STUB_issue_request_batch = NULL;
+#endif
+
+    /* Cleaning proc fs */
+    remove_proc_entry(PROC_NAME, NULL);
+    remove_proc_entry(STATS_PROC_NAME, NULL);
+    remove_proc_entry(LATENCY_PROC_NAME, NULL);
+	printk(KERN_INFO "Elevator: %s: /proc/%s removed\n",  __FUNCTION__, PROC_NAME);
+	misc_deregister(&elevator_dev);
+
+	/* deactivate elevator, without waiting for anyone to be delivered, 
+	and wait for a stop under way too */
+	elevator_deactivate(STOP_FAST);
+	wait_event(elevator.stopped, READ_ONCE(elevator.state) == OFFLINE);
+	flush_delayed_work(&elevator.stop_work);
+
+	for (c = 0; c < num_cars; ++c) {
+		mutex_destroy(&elevator.cars[c].mutex);
+	}
+	cars_free();
+	kfree(demand.arrivals);
+	kfree(elevator.floor_waiting);
+	free_pages_exact(stats_page, stats_size);
+	passenger_pool_destroy();
+}
+module_exit(elevator_exit);
+
+/* Implements start_elevator() system call */
+long my_start_elevator(void) {
+	int err;
+
+    printk(KERN_NOTICE "Elevator: %s\n", __FUNCTION__);
+
+	down_write(&elevator.sem);	
+	err = elevator.state == OFFLINE ? 0 : 1; /* check if elevator already running */
+	if (!err) {
+		err = elevator_activate();
+	}
+	up_write(&elevator.sem);
+
+	return err;
+}
+
+/* Implements issue_request() system call */
+long my_issue_request(int start_floor, int destination_floor, int type) {
+    int err;
+
+	err = (is_active()) ? 0 : 1; /* check if elevator running */
+	
+	if (err) {
+		atomic_inc(&elevator.rejected);
+		return 1;
+	}
+	/* validate request */
+	if (!is_valid_request(start_floor, destination_floor, type)) {
+		atomic_inc(&elevator.rejected);
+		return 1;
+	}
+	/* add passenger at the corresponding floor */
+	err = add_passenger(start_floor, destination_floor, type);
+	atomic_inc(err == 0 ? &elevator.requests : &elevator.rejected);
+	return err;
+}
+
+/* checks floors and passenger type of a request (a passenger must go 
+somewhere: no policy would ever stop to pick them up otherwise) */
+static int is_valid_request(int start_floor, int destination_floor, int type) {
+	return start_floor >= LOBBY && start_floor <= num_floors && 
+		destination_floor >= LOBBY && destination_floor <= num_floors && 
+		start_floor != destination_floor && 
+		(type == GRAPE || type == WOLF || type == SHEEP);
+}
+
+/* queue a batch and count it, for issue_request_batch() and writes to 
+/dev/elevator */
+static long submit_requests(struct elevator_request *reqs, int count) {
+	long queued;
+
+	queued = add_passengers(reqs, count);
+	atomic_add(queued, &elevator.requests);
+	atomic_add(count - queued, &elevator.rejected);
+	return queued;
+}
+
+/* Implements issue_request_batch() system call. Returns the number of 
+queued passengers (0 if the elevator is not running) and writes each 
+entry's status back to the user array. */
+long my_issue_request_batch(struct elevator_request __user *ureqs, int count) {
+	struct elevator_request *reqs;
+	long result;
+
+	if (count <= 0 || count > ELEVATOR_BATCH_MAX) {
+		return -EINVAL;
+	}
+
+	reqs = kmalloc_array(count, sizeof(*reqs), GFP_KERNEL);
+	if (reqs == NULL) {
+		return -ENOMEM;
+	}
+	if (copy_from_user(reqs, ureqs, count * sizeof(*reqs))) {
+		kfree(reqs);
+		return -EFAULT;
+	}
+
+	result = submit_requests(reqs, count);
+	if (copy_to_user(ureqs, reqs, count * sizeof(*reqs))) {
+		result = -EFAULT;
+	}
+	kfree(reqs);
+	return result;
+}
+
+/* stop the elevator the way how says and wait until it has; -EINTR if a 
+signal came first, in which case it goes on stopping without us */
+static long stop_and_wait(int how) {
+	long err;
+
+	err = elevator_deactivate(how);
+	if (err) {
+		return err; /* already stopped or stopping */
+	}
+	if (wait_event_interruptible(elevator.stopped, 
+			READ_ONCE(elevator.state) == OFFLINE)) {
+		return -EINTR;
+	}
+	return 0;
+}
+
+/* Implements stop_elevator() system call */
+long my_stop_elevator(void) {
+    printk(KERN_NOTICE "Elevator: %s\n", __FUNCTION__);
+
+	return stop_and_wait(READ_ONCE(fast_stop) ? STOP_FAST : STOP_DRAIN);
+}
+
+/* car stop condition */
+static int can_stop(Car *car) {
+	return READ_ONCE(elevator.deactivating) && car->num_of_passengers == 0;
+}
+
+/* the lowest floor at or above from whose bit is set, or 0 */
+static int next_floor(const unsigned long *bits, int from) {
+	unsigned long i;
+
+	i = find_next_bit(bits, num_floors + 1, from);
+	return i <= num_floors ? i : 0;
+}
+
+/* the highest floor at or below from whose bit is set, or 0 */
+static int prev_floor(const unsigned long *bits, int from) {
+	unsigned long i;
+
+	i = find_last_bit(bits, from + 1);
+	return i <= from ? i : 0;
+}
+
+/* the waiting floor nearest to floor in bits, or 0 */
+static int nearest_floor(const unsigned long *bits, int floor) {
+	int above, below;
+
+	above = next_floor(bits, floor);
+	below = prev_floor(bits, floor);
+	if (above == 0 || (below != 0 && floor - below <= above - floor)) {
+		return below;
+	}
+	return above;
+}
+
+/* find the nearest floor to which the waiting car should move */
+static int find_nearest_request(Car *car) {
+	int up, down, floor;
+
+	floor = car->current_floor;
+	up = nearest_floor(car->waiting_up, floor);
+	down = nearest_floor(car->waiting_down, floor);
+	if (up == 0 || (down != 0 && abs(down - floor) < abs(up - floor))) {
+		return down;
+	}
+	return up;
+}
+
+/* determine if a passenger fits in the car and gets along with everyone 
+on the board; returns why not, or REJECT_NONE */
+static RejectReason board_check(Car *car, Passenger *p) {
+	if (car->num_of_passengers == capacity)
+		return REJECT_CAPACITY; /* no room */
+	if (p->type == SHEEP && car->num_wolves > 0)
+		/* a wolf on the board: a sheep cann't be loaded */
+		return REJECT_WOLF_SHEEP;
+	if (p->type == GRAPE && car->num_sheep > 0)
+		/* a sheep on the board: a grape cann't be loaded */
+		return REJECT_SHEEP_GRAPE;
+	return REJECT_NONE;
+}
+
+/* the same for a car heading dir */
+static RejectReason load_check(Car *car, Passenger *p, int dir) {
+	RejectReason reason;
+
+	reason = board_check(car, p);
+	if (reason != REJECT_NONE)
+		return reason;
+	/* The elevator does not take on board passengers who need to go 
+	the other direction. */
+	if (dir == UP && p->destination < car->current_floor)
+		return REJECT_DIRECTION;
+	if (dir == DOWN && p->destination > car->current_floor)
+		return REJECT_DIRECTION;
+	return REJECT_NONE;
+}
+
+/* boolean form of the check above */
+static int can_board(Car *car, Passenger *p) {
+	return board_check(car, p) == REJECT_NONE;
+}
+
+/* Check if the car needs to stop to unload or load passengers.
+ This will prevent unnecessary stops.
+ However, the car may stop but not take passengers 
+ if they are incompatible. */
+static int need_stop_on_floor(Car *car, int floor, int direction) {
+	/* the elevator picks up only those passengers who go its way, and 
+	nobody once the bank is stopping */
+	if (is_active() && 
+			test_bit(floor, direction == UP ? car->waiting_up : car->waiting_down))
+		return 1;
+	/* the bitmap is only changed by the car's own work */
+	return test_bit(floor, car->getting_off);
+}
+
+/* find the topmost floor, to which the car moving up should rise: the 
+highest floor where someone waits or gets off. Waiting passengers' own 
+destinations are not considered; they extend the sweep once on board. 
+While the bank stops only the riders count. */
+static int find_upper_bound(Car *car) {
+	int floor;
+
+	floor = max(car->current_floor, prev_floor(car->getting_off, num_floors));
+	if (!is_active()) {
+		return floor;
+	}
+	return max3(floor, prev_floor(car->waiting_up, num_floors), 
+		prev_floor(car->waiting_down, num_floors));
+}
+
+/* the lowest floor at or above LOBBY in bits, or floor if there is none 
+below it */
+static int lowest_below(const unsigned long *bits, int floor) {
+	int i;
+
+	i = next_floor(bits, LOBBY);
+	return i != 0 && i < floor ? i : floor;
+}
+
+/* find the lowest floor, to which the downward car should go down. */
+static int find_lower_bound(Car *car) {
+	int floor;
+
+	floor = lowest_below(car->getting_off, car->current_floor);
+	if (!is_active()) {
+		return floor;
+	}
+	return min3(floor, lowest_below(car->waiting_up, floor), 
+		lowest_below(car->waiting_down, floor));
+}
+
+/* loading passengers operation */
+/* a stop, in two steps load_ms apart: first unload */
+static void stop_unload(Car *car, int floor) {	
+	mutex_lock(&car->mutex);			
+	set_state(car, LOADING);
+	car->stops += 1;
+	elevator_unload(car, floor);		
+	publish_stats(car);
+	mutex_unlock(&car->mutex);	
+}
+
+/* then load, as the doors close */
+static void stop_load(Car *car, int floor, int dir) {	
+	/* passengers who arrived while the doors were open board too */
+	drain_ingress(car);
+
+	mutex_lock(&car->mutex);
+	/* load passengers in the active state only */
+	if (is_active()) {
+		car->policy->board(car, floor, dir);
+		publish_stats(car);
+	} 
+	mutex_unlock(&car->mutex);
+}
+
+/* change the car's state (car->mutex held, or the bank stopped) */
+static void set_state(Car *car, State state) {
+	if (car->state != state) {
+		trace_elevator_state(car->id, car->state, state);
+		car->state = state;
+	}
+}
+
+/* does the car have anyone on the board or waiting for it */
+static int has_work(Car *car) {
+	return car->num_of_passengers > 0 || find_nearest_request(car) != 0;
+}
+
+/* number of passengers on the board getting off at floor (car->mutex 
+held) */
+static int count_unloading(Car *car, int floor) {
+	return car->num_getting_off[floor - 1];
+}
+
+/* number of passengers waiting at floor who could board now, in either 
+direction; none while the bank stops (car->mutex held) */
+static int count_boardable(Car *car, int floor) {
+	struct list_head *temp;
+	Passenger *p;
+	int n;
+
+	n = 0;
+	if (!is_active()) {
+		return 0;
+	}
+	if (!test_bit(floor, car->waiting_up) && 
+			!test_bit(floor, car->waiting_down)) {
+		return 0;
+	}
+	spin_lock(&car->floors[floor - 1].lock);
+	list_for_each(temp, &car->floors[floor - 1].list) { 
+		p = list_entry(temp, Passenger, list);
+		if (can_board(car, p)) {
+			n += 1;
+		}
+	} 
+	spin_unlock(&car->floors[floor - 1].lock);
+	return n;
+}
+
+/* LOOK: sweep in one direction as far as the last request, then turn */
+static int look_next_target(Car *car, int *dir) {
+	int next, curr;
+
+	curr = car->current_floor;
+	next = *dir == UP ? find_upper_bound(car) : find_lower_bound(car);
+	if (next != curr) {
+		return next;
+	}
+	/* nothing ahead: turn around, if only to pick up someone here going 
+	the other way */
+	next = *dir == UP ? find_lower_bound(car) : find_upper_bound(car);
+	if (next == curr && !need_stop_on_floor(car, curr, *dir == UP ? DOWN : UP)) {
+		return 0;
+	}
+	*dir = *dir == UP ? DOWN : UP;
+	return next;
+}
+
+/* SCAN: sweep all the way to the top or the lobby before turning, as long 
+as there is any work at all */
+static int scan_next_target(Car *car, int *dir) {
+	if (!has_work(car)) {
+		return 0;
+	}
+	if (*dir == UP) {
+		if (car->current_floor < num_floors) {
+			return num_floors;
+		}
+		*dir = DOWN;
+		return LOBBY;
+	}
+	if (car->current_floor > LOBBY) {
+		return LOBBY;
+	}
+	*dir = UP;
+	return num_floors;
+}
+
+/* the lower of two floors, 0 meaning none */
+static int lower_floor(int a, int b) {
+	return a == 0 || (b != 0 && b < a) ? b : a;
+}
+
+/* the lowest floor at or above from where someone waits or gets off, or 
+0; only there can a stop be of use */
+static int next_candidate(Car *car, int from) {
+	return lower_floor(lower_floor(next_floor(car->waiting_up, from), 
+		next_floor(car->waiting_down, from)), 
+		next_floor(car->getting_off, from));
+}
+
+/* the same at or below from */
+static int prev_candidate(Car *car, int from) {
+	return max3(prev_floor(car->waiting_up, from), 
+		prev_floor(car->waiting_down, from), 
+		prev_floor(car->getting_off, from));
+}
+
+/* does someone get off at floor or can someone waiting there get on 
+(car->mutex held) */
+static int stop_of_use(Car *car, int floor) {
+	return count_unloading(car, floor) > 0 || count_boardable(car, floor) > 0;
+}
+
+/* stop wherever someone gets off or someone waiting can get on, whatever 
+their direction (SSTF and greedy) */
+static int any_stop_on_floor(Car *car, int floor, int dir) {
+	int result;
+
+	mutex_lock(&car->mutex);
+	result = stop_of_use(car, floor);
+	mutex_unlock(&car->mutex);
+	return result;
+}
+
+/* SSTF: go to the nearest floor where someone gets off or can get on, 
+preferring the current direction on a tie */
+static int sstf_next_target(Car *car, int *dir) {
+	int curr, next, above, below;
+
+	curr = car->current_floor;
+
+	mutex_lock(&car->mutex);
+	/* the nearest such floor on each side, among the candidates only */
+	above = next_candidate(car, curr + 1);
+	while (above != 0 && !stop_of_use(car, above)) {
+		above = next_candidate(car, above + 1);
+	}
+	below = prev_candidate(car, curr - 1);
+	while (below != 0 && (above == 0 || curr - below <= above - curr) && 
+			!stop_of_use(car, below)) {
+		below = prev_candidate(car, below - 1);
+	}
+	mutex_unlock(&car->mutex);
+
+	if (below != 0 && above != 0 && curr - below > above - curr) {
+		below = 0; /* farther than above, and maybe of no use */
+	}
+	if (above == 0 || (below != 0 && 
+			(curr - below < above - curr || *dir != UP))) {
+		next = below;
+	} else {
+		next = above;
+	}
+
+	if (next != 0) {
+		*dir = next > curr ? UP : DOWN;
+	}
+	return next;
+}
+
+/* throughput-greedy: go to the floor with the most passengers delivered 
+or picked up per second spent getting there and stopping */
+static int greedy_next_target(Car *car, int *dir) {
+	int i, curr, next, gain, best_gain, room;
+	u64 cost, best_cost;
+
+	curr = car->current_floor;
+	next = 0;
+	best_gain = 0;
+	best_cost = 1;
+
+	mutex_lock(&car->mutex);
+	/* floors where nobody waits or gets off gain nothing */
+	for (i = next_candidate(car, LOBBY); i != 0; 
+			i = next_candidate(car, i + 1)) {
+		if (i == curr) {
+			continue;
+		}
+		gain = count_unloading(car, i);
+		room = capacity - car->num_of_passengers + gain;
+		gain += min(count_boardable(car, i), room);
+		cost = (u64)abs(i - curr) * READ_ONCE(floor_ms) + READ_ONCE(load_ms);
+		/* gain / cost > best_gain / best_cost, in u64: the products of 
+		1000 floors and a large floor_ms overflow an int */
+		if (gain * best_cost > best_gain * cost) {
+			best_gain = gain;
+			best_cost = cost;
+			next = i;
+		}
+	}
+	mutex_unlock(&car->mutex);
+
+	if (next != 0) {
+		*dir = next > curr ? UP : DOWN;
+	}
+	return next;
+}
+
+/* board everyone who can get on, in FIFO order and whatever their 
+direction (car->mutex held) */
+static void board_any(Car *car, int floor, int dir) {
+	struct list_head *temp;
+	struct list_head *dummy; 
+	RejectReason reason;
+	Passenger *p;
+
+	if (READ_ONCE(optimise_boarding)) {
+		board_optimised(car, floor, 0);
+		return;
+	}
+
+	spin_lock(&car->floors[floor - 1].lock);
+	list_for_each_safe(temp, dummy, &car->floors[floor - 1].list) { 		
+		p = list_entry(temp, Passenger, list);
+		reason = board_check(car, p);
+		if (reason == REJECT_NONE) {
+			board_passenger(car, &car->floors[floor - 1], p);
+		} else {
+			trace_elevator_reject(car->id, floor, p->destination, p->type, 
+				reason);
+		}
+	}
+	spin_unlock(&car->floors[floor - 1].lock);
+}
+
+/* board the passengers with the shortest rides first, so seats free up 
+again soonest (car->mutex held) */
+static void board_nearest_first(Car *car, int floor, int dir) {
+	struct list_head *temp;
+	Passenger *p, *best;
+	Floor *f;
+
+	f = &car->floors[floor - 1];
+	spin_lock(&f->lock);
+	for (;;) {
+		best = NULL;
+		list_for_each(temp, &f->list) { 		
+			p = list_entry(temp, Passenger, list);
+			if (can_board(car, p) && (best == NULL || 
+					abs(p->destination - floor) < 
+					abs(best->destination - floor))) {
+				best = p;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		board_passenger(car, f, best);
+	}
+	/* whoever is left could not get on */
+	list_for_each(temp, &f->list) { 		
+		p = list_entry(temp, Passenger, list);
+		trace_elevator_reject(car->id, floor, p->destination, p->type, 
+			board_check(car, p));
+	}
+	spin_unlock(&f->lock);
+}
+
+/* in ELEVATOR_POLICY_* order */
+#define POLICY_LOOK ELEVATOR_POLICY_LOOK
+#define NUM_POLICIES 4
+
+static const Policy policies[NUM_POLICIES] = {
+	{ "look", need_stop_on_floor, look_next_target, elevator_load },
+	{ "scan", need_stop_on_floor, scan_next_target, elevator_load },
+	{ "sstf", any_stop_on_floor, sstf_next_target, board_any },
+	{ "greedy", any_stop_on_floor, greedy_next_target, board_nearest_first },
+};
+
+/* policy of the cars, by name; idle cars pick up a new value */
+static int policy_id = POLICY_LOOK;
+
+static int policy_set(const char *val, const struct kernel_param *kp) {
+	int i;
+
+	for (i = 0; i < NUM_POLICIES; ++i) {
+		if (sysfs_streq(val, policies[i].name)) {
+			WRITE_ONCE(*(int *)kp->arg, i);
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int policy_get(char *buffer, const struct kernel_param *kp) {
+	return sprintf(buffer, "%s\n", policies[READ_ONCE(*(int *)kp->arg)].name);
+}
+
+static const struct kernel_param_ops policy_ops = {
+	.set = policy_set,
+	.get = policy_get,
+};
+
+module_param_cb(policy, &policy_ops, &policy_id, 0644);
+MODULE_PARM_DESC(policy, "scheduling policy: look, scan, sstf or greedy "
+	"(a running car switches when it is next idle)");
+
+static const Policy *selected_policy(void) {
+	return &policies[READ_ONCE(policy_id)];
+}
+
+static bool park;
+module_param(park, bool, 0644);
+MODULE_PARM_DESC(park, "move idle cars to where calls are expected");
+
+static int demand_init(void) {
+	demand.arrivals = kcalloc(DEMAND_WINDOWS * num_floors, sizeof(atomic_t), 
+		GFP_KERNEL);
+	return demand.arrivals == NULL ? -ENOMEM : 0;
+}
+
+/* count an arrival at floor (called by producers, without locks; 
+concurrent decays may lose a little weight, which only blurs history) */
+static void record_demand(int floor) {
+	u64 now, day;
+	int w, old, i;
+	atomic_t *row;
+
+	now = building_clock();
+	day = div64_u64(now, DEMAND_WINDOW_MS * DEMAND_WINDOWS);
+	w = div64_u64(now, DEMAND_WINDOW_MS) - day * DEMAND_WINDOWS;
+	row = &demand.arrivals[w * num_floors];
+
+	old = atomic_read(&demand.day[w]);
+	if (old != (int)day && atomic_cmpxchg(&demand.day[w], old, day) == old) {
+		/* first arrival of a new day in this window */
+		for (i = 0; i < num_floors; ++i) {
+			atomic_set(&row[i], atomic_read(&row[i]) * 3 / 4);
+		}
+	}
+	atomic_add(DEMAND_ONE, &row[floor - 1]);
+}
+
+/* where car should wait for the next call, or 0 to stay put */
+static int park_target(Car *car) {
+	atomic_t *row;
+	u64 total, goal, sum;
+	int w, i;
+
+	if (!READ_ONCE(park)) {
+		return 0;
+	}
+	w = div64_u64(building_clock(), DEMAND_WINDOW_MS) % DEMAND_WINDOWS;
+	row = &demand.arrivals[w * num_floors];
+	total = 0;
+	for (i = 0; i < num_floors; ++i) {
+		total += atomic_read(&row[i]);
+	}
+	if (total == 0) {
+		return 0; /* nothing learnt about this hour yet */
+	}
+
+	goal = div64_u64(total * (2 * car->id - 1), 2 * num_cars);
+	sum = 0;
+	for (i = 0; i < num_floors; ++i) {
+		sum += atomic_read(&row[i]);
+		if (sum > goal) {
+			break;
+		}
+	}
+	return i + 1;
+}
+
+/* Car state machine. Instead of a thread per car sleeping through 
+every floor and stop, a car is its delayed work item on elevator_wq: 
+each run of car_step() takes the car through the steps that take no 
+building time and re-arms the work for when the next is due, the end of 
+a stop or the arrival at the next floor. A moving car costs a timer and 
+an idle one nothing. The work rather than an hrtimer callback, because 
+a step takes car->mutex and the floor locks.
+ - STEP_DECIDE: stop the car if it is done, or open the doors if the 
+   policy stops here (then STEP_LOAD after load_ms); otherwise choose.
+ - STEP_LOAD: board and choose.
+ - STEP_ARRIVE: the car reached the next floor; decide again.
+ - STEP_DONE: the bank stopped; nothing until the next start.
+ Choosing asks the policy where to head. A car that turned decides again 
+ at once, one that moves arrives after floor_ms, and one with nothing to 
+ do parks: it arms no work (or only the idle_poll_ms one) and waits for 
+ car_wake(). */
+#define CAR_NOW 0 /* go on with the next step at once */
+#define CAR_PARKED UINT_MAX /* nothing to schedule until car_wake() */
+#define CAR_DONE (UINT_MAX - 1) /* stopped for good */
+
+/* wake a parked car because a passenger was assigned to it or the bank 
+is stopping (under elevator.sem, so the work is alive) */
+static void car_wake(Car *car) {
+	if (atomic_xchg(&car->idle, 0)) {
+		mod_delayed_work(elevator_wq, &car->work, 0);
+	}
+}
+
+/* nothing to do (nobody on the board or waiting for the car); a change 
+of policy takes effect here */
+static void car_park(Car *car) {
+	unsigned int poll;
+
+	mutex_lock(&car->mutex);
+	set_state(car, IDLE);
+	car->policy = selected_policy();
+	publish_stats(car);
+	mutex_unlock(&car->mutex);
+
+	car->step = STEP_DECIDE;
+	poll = READ_ONCE(idle_poll_ms);
+	if (poll > 0) {
+		queue_delayed_work(elevator_wq, &car->work, building_delay(poll));
+	}
+	/* a producer that queued before idle was set did not wake us */
+	atomic_set(&car->idle, 1);
+	smp_mb__after_atomic();
+	if (atomic_read(&car->num_waiting) > 0 || READ_ONCE(elevator.deactivating)) {
+		car_wake(car);
+	}
+}
+
+/* ask the policy where to head next; returns the building ms until the 
+next step, or CAR_NOW or CAR_PARKED */
+static unsigned int car_choose(Car *car) {
+	int prev_dir, next, curr;
+
+	curr = car->current_floor;
+	prev_dir = car->dir;
+	next = car->policy->next_target(car, &car->dir);
+	if (next == 0) {
+		next = park_target(car);
+		if (next == 0 || next == curr) {
+			car_park(car);
+			return CAR_PARKED;
+		}
+		/* nothing to do but move to the parking floor */
+		car->dir = next > curr ? UP : DOWN;
+	}
+
+	mutex_lock(&car->mutex);			
+	set_state(car, car->dir); /* state = UP or DOWN */
+	car->direction = car->dir;
+	car->target = next;
+	publish_stats(car);
+	mutex_unlock(&car->mutex);
+
+	if (car->dir != prev_dir) {
+		/* turned: check this floor again for the new direction */
+		car->step = STEP_DECIDE;
+		return CAR_NOW;
+	}
+	car->step = STEP_ARRIVE;
+	return READ_ONCE(floor_ms);
+}
+
+/* the car reached the next floor towards its target */
+static void car_move(Car *car) {
+	int curr;
+
+	curr = car->current_floor;
+	mutex_lock(&car->mutex);	
+	car->current_floor += car->target > curr ? 1 : -1;
+	trace_elevator_floor(car->id, curr, car->current_floor);
+	car->floors_travelled += 1;
+	publish_stats(car);
+	mutex_unlock(&car->mutex);
+}
+
+/* fast stop: everyone on the board gets off where the car is, delivered 
+if it is their floor */
+static void car_evacuate(Car *car) {
+	struct list_head *temp;
+	struct list_head *dummy; 
+	Passenger *p;	
+	int floor;
+
+	mutex_lock(&car->mutex);
+	floor = car->current_floor;
+	set_state(car, LOADING);
+	elevator_unload(car, floor);
+	list_for_each_safe(temp, dummy, &car->list) { 
+		p = list_entry(temp, Passenger, list);
+		list_del(temp);	
+		car->num_of_passengers -= 1;
+		count_passenger(car, p->type, -1);
+		count_getting_off(car, p, -1);
+		publish_event(car, p, ELEVATOR_EVENT_DROP, floor);
+		free_passenger(p);
+		atomic_inc(&elevator.dropped);
+	}
+	publish_stats(car);
+	mutex_unlock(&car->mutex);
+}
+
+/* take one step; returns as car_choose(), or CAR_DONE */
+static unsigned int car_advance(Car *car) {
+	int curr;
+
+	if (READ_ONCE(elevator.deactivating) == STOP_FAST) {
+		/* cut the travel or the stop short */
+		if (car->step == STEP_ARRIVE) {
+			car_move(car);
+		}
+		car_evacuate(car);
+		return CAR_DONE;
+	}
+	curr = car->current_floor;
+	switch (car->step) {
+	case STEP_ARRIVE:
+		car_move(car);
+		car->step = STEP_DECIDE;
+		return CAR_NOW;
+	case STEP_LOAD:
+		stop_load(car, curr, car->dir);
+		return car_choose(car);
+	default:
+		if (can_stop(car)) {
+			return CAR_DONE;
+		}
+		/* pick up requests that arrived since the last decision */
+		drain_ingress(car);
+		if (car->policy->should_stop(car, curr, car->dir)) {
+			stop_unload(car, curr); /* state = LOADING */
+			car->step = STEP_LOAD;
+			return READ_ONCE(load_ms);
+		}
+		return car_choose(car);
+	}
+}
+
+/* work function of a car: run steps until one takes building time */
+static void car_step(struct work_struct *work) {
+	Car *car;
+	unsigned int ms;
+
+	car = container_of(to_delayed_work(work), Car, work);
+	if (car->step == STEP_DONE) {
+		return; /* kicked by a fast stop after it was done */
+	}
+	if (car->step == STEP_DECIDE) {
+		/* started or woken rather than due: a new schedule from now, 
+		under the policy selected now */
+		car->due = ktime_get();
+		mutex_lock(&car->mutex);
+		car->policy = selected_policy();
+		mutex_unlock(&car->mutex);
+	}
+	atomic_set(&car->idle, 0);
+	do {
+		ms = car_advance(car);
+	} while (ms == CAR_NOW);
+
+	if (ms == CAR_DONE) {
+		/* the bank is stopping and nobody is on the board */
+		car->step = STEP_DONE;
+		if (atomic_dec_and_test(&elevator.running)) {
+			schedule_delayed_work(&elevator.stop_work, 0);
+		}
+	} else if (ms != CAR_PARKED) {
+		/* steps follow each other on the wall clock from when the 
+		first was due, not from when each ran, so rounding every delay 
+		up to a jiffy does not add up over a trip */
+		car->due = ktime_add_ns(car->due, building_ns(ms));
+		queue_delayed_work(elevator_wq, &car->work, jiffies_until(car->due));
+	}
+}
+
+/* Control device. /dev/elevator offers the system calls' operations 
+without a patched kernel: writes queue whole struct elevator_request 
+records, ioctls start, stop and configure the bank, and reads return the 
+events of the delivery rings above. */
+
+/* queue the records written and report each outcome on the file's own 
+ring, so a producer can match them by index */
+static ssize_t dev_write(struct file *file, const char __user *ubuf, 
+size_t count, loff_t *ppos) {
+	Subscriber *sub = file->private_data;
+	struct elevator_request *reqs;
+	struct elevator_event ev;
+	int n, i;
+
+	n = min_t(size_t, count / sizeof(*reqs), ELEVATOR_BATCH_MAX);
+	if (n == 0) {
+		return -EINVAL;
+	}
+	reqs = kmalloc_array(n, sizeof(*reqs), GFP_KERNEL);
+	if (reqs == NULL) {
+		return -ENOMEM;
+	}
+	if (copy_from_user(reqs, ubuf, n * sizeof(*reqs))) {
+		kfree(reqs);
+		return -EFAULT;
+	}
+	submit_requests(reqs, n);
+
+	if (sub->mask & BIT(ELEVATOR_EVENT_REQUEST)) {
+		memset(&ev, 0, sizeof(ev));
+		ev.kind = ELEVATOR_EVENT_REQUEST;
+		ev.time_ns = ktime_to_ns(ktime_get());
+		spin_lock(&events_lock);
+		for (i = 0; i < n; ++i) {
+			ev.id = reqs[i].status == 0 ? reqs[i].id : 0;
+			ev.floor = reqs[i].start;
+			ev.status = reqs[i].status;
+			ev.index = i;
+			push_event(sub, &ev);
+		}
+		spin_unlock(&events_lock);
+		wake_up_interruptible(&sub->wait);
+	}
+	kfree(reqs);
+	return n * sizeof(*reqs);
+}
+
+static void get_config(struct elevator_config *config) {
+	memset(config, 0, sizeof(*config));
+	config->num_cars = num_cars;
+	config->num_floors = num_floors;
+	config->capacity = capacity;
+	config->floor_ms = READ_ONCE(floor_ms);
+	config->load_ms = READ_ONCE(load_ms);
+	config->idle_poll_ms = READ_ONCE(idle_poll_ms);
+	config->time_compression = READ_ONCE(time_compression);
+	config->policy = READ_ONCE(policy_id);
+	config->optimise_boarding = READ_ONCE(optimise_boarding);
+	config->max_skips = READ_ONCE(max_skips);
+	config->park = READ_ONCE(park);
+	config->max_waiting = READ_ONCE(max_waiting);
+	config->max_waiting_per_floor = READ_ONCE(max_waiting_per_floor);
+	config->passenger_budget_kb = READ_ONCE(passenger_budget_kb);
+}
+
+/* apply the run-time parameters of config, all or none; they take effect 
+as if written to /sys/module/elevator/parameters */
+static int set_config(const struct elevator_config *config) {
+	if (config->num_cars != num_cars || config->num_floors != num_floors || 
+			config->capacity != capacity) {
+		return -EINVAL;
+	}
+	if (!timings_valid(config->floor_ms, config->load_ms, 
+			config->time_compression) || 
+			config->policy >= NUM_POLICIES || 
+			config->optimise_boarding > 1 || config->park > 1) {
+		return -EINVAL;
+	}
+	WRITE_ONCE(floor_ms, config->floor_ms);
+	WRITE_ONCE(load_ms, config->load_ms);
+	WRITE_ONCE(idle_poll_ms, config->idle_poll_ms);
+	WRITE_ONCE(time_compression, config->time_compression);
+	WRITE_ONCE(policy_id, config->policy);
+	WRITE_ONCE(optimise_boarding, config->optimise_boarding);
+	WRITE_ONCE(max_skips, config->max_skips);
+	WRITE_ONCE(park, config->park);
+	WRITE_ONCE(max_waiting, config->max_waiting);
+	WRITE_ONCE(max_waiting_per_floor, config->max_waiting_per_floor);
+	WRITE_ONCE(passenger_budget_kb, config->passenger_budget_kb);
+	return 0;
+}
+
+static long dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	Subscriber *sub = file->private_data;
+	struct elevator_config config;
+	long err;
+	u32 mask;
+
+	switch (cmd) {
+	case ELEVATOR_IOC_START:
+		err = my_start_elevator();
+		return err == 1 ? -EBUSY : err;
+	case ELEVATOR_IOC_STOP:
+		err = my_stop_elevator();
+		return err == 1 ? -EALREADY : err;
+	case ELEVATOR_IOC_STOP_FAST:
+		err = stop_and_wait(STOP_FAST);
+		return err == 1 ? -EALREADY : err;
+	case ELEVATOR_IOC_GET_CONFIG:
+		get_config(&config);
+		if (copy_to_user((void __user *)arg, &config, sizeof(config))) {
+			return -EFAULT;
+		}
+		return 0;
+	case ELEVATOR_IOC_SET_CONFIG:
+		if (!capable(CAP_SYS_ADMIN)) {
+			return -EPERM;
+		}
+		if (copy_from_user(&config, (void __user *)arg, sizeof(config))) {
+			return -EFAULT;
+		}
+		return set_config(&config);
+	case ELEVATOR_IOC_EVENTS:
+		if (get_user(mask, (u32 __user *)arg)) {
+			return -EFAULT;
+		}
+		spin_lock(&events_lock);
+		sub->mask = mask;
+		spin_unlock(&events_lock);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+/* 32-bit callers pass their pointers through compat_ptr(); from 5.5 on 
+compat_ptr_ioctl() does this */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0) && defined(CONFIG_COMPAT)
+static long dev_compat_ioctl(struct file *file, unsigned int cmd, 
+unsigned long arg) {
+	return dev_ioctl(file, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif
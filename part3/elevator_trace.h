@@ -0,0 +1,154 @@
+/* Tracepoints of the elevator module (events/elevator/ in tracefs).
+ Enable them with, for example,
+	echo 1 > /sys/kernel/debug/tracing/events/elevator/enable
+ or record them with perf record -e 'elevator:*'. */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM elevator
+
+#if !defined(_ELEVATOR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ELEVATOR_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* values shared with elevator.c (State, PassengerType, RejectReason) */
+#define show_state(s) __print_symbolic(s, \
+	{ 0, "OFFLINE" }, { 1, "IDLE" }, { 2, "LOADING" }, { 3, "UP" }, \
+	{ 4, "DOWN" })
+
+#define show_type(t) __print_symbolic(t, \
+	{ 0, "grape" }, { 1, "sheep" }, { 2, "wolf" })
+
+#define show_reason(r) __print_symbolic(r, \
+	{ 1, "capacity" }, { 2, "wolf/sheep" }, { 3, "sheep/grape" }, \
+	{ 4, "direction" })
+
+/* a request was accepted and handed to a car */
+TRACE_EVENT(elevator_enqueue,
+	TP_PROTO(int car, int start, int dest, int type),
+	TP_ARGS(car, start, dest, type),
+	TP_STRUCT__entry(
+		__field(int, car)
+		__field(int, start)
+		__field(int, dest)
+		__field(int, type)
+	),
+	TP_fast_assign(
+		__entry->car = car;
+		__entry->start = start;
+		__entry->dest = dest;
+		__entry->type = type;
+	),
+	TP_printk("car=%d start=%d dest=%d type=%s", __entry->car,
+		__entry->start, __entry->dest, show_type(__entry->type))
+);
+
+/* a waiting passenger got on */
+TRACE_EVENT(elevator_board,
+	TP_PROTO(int car, int floor, int dest, int type, long wait_ms),
+	TP_ARGS(car, floor, dest, type, wait_ms),
+	TP_STRUCT__entry(
+		__field(int, car)
+		__field(int, floor)
+		__field(int, dest)
+		__field(int, type)
+		__field(long, wait_ms)
+	),
+	TP_fast_assign(
+		__entry->car = car;
+		__entry->floor = floor;
+		__entry->dest = dest;
+		__entry->type = type;
+		__entry->wait_ms = wait_ms;
+	),
+	TP_printk("car=%d floor=%d dest=%d type=%s wait_ms=%ld", __entry->car,
+		__entry->floor, __entry->dest, show_type(__entry->type),
+		__entry->wait_ms)
+);
+
+/* a waiting passenger was left behind at a stop */
+TRACE_EVENT(elevator_reject,
+	TP_PROTO(int car, int floor, int dest, int type, int reason),
+	TP_ARGS(car, floor, dest, type, reason),
+	TP_STRUCT__entry(
+		__field(int, car)
+		__field(int, floor)
+		__field(int, dest)
+		__field(int, type)
+		__field(int, reason)
+	),
+	TP_fast_assign(
+		__entry->car = car;
+		__entry->floor = floor;
+		__entry->dest = dest;
+		__entry->type = type;
+		__entry->reason = reason;
+	),
+	TP_printk("car=%d floor=%d dest=%d type=%s reason=%s", __entry->car,
+		__entry->floor, __entry->dest, show_type(__entry->type),
+		show_reason(__entry->reason))
+);
+
+/* a passenger got off at their destination */
+TRACE_EVENT(elevator_unload,
+	TP_PROTO(int car, int floor, int type, long ride_ms),
+	TP_ARGS(car, floor, type, ride_ms),
+	TP_STRUCT__entry(
+		__field(int, car)
+		__field(int, floor)
+		__field(int, type)
+		__field(long, ride_ms)
+	),
+	TP_fast_assign(
+		__entry->car = car;
+		__entry->floor = floor;
+		__entry->type = type;
+		__entry->ride_ms = ride_ms;
+	),
+	TP_printk("car=%d floor=%d type=%s ride_ms=%ld", __entry->car,
+		__entry->floor, show_type(__entry->type), __entry->ride_ms)
+);
+
+/* a car moved one floor */
+TRACE_EVENT(elevator_floor,
+	TP_PROTO(int car, int from, int to),
+	TP_ARGS(car, from, to),
+	TP_STRUCT__entry(
+		__field(int, car)
+		__field(int, from)
+		__field(int, to)
+	),
+	TP_fast_assign(
+		__entry->car = car;
+		__entry->from = from;
+		__entry->to = to;
+	),
+	TP_printk("car=%d from=%d to=%d", __entry->car, __entry->from,
+		__entry->to)
+);
+
+/* a car changed state */
+TRACE_EVENT(elevator_state,
+	TP_PROTO(int car, int old_state, int new_state),
+	TP_ARGS(car, old_state, new_state),
+	TP_STRUCT__entry(
+		__field(int, car)
+		__field(int, old_state)
+		__field(int, new_state)
+	),
+	TP_fast_assign(
+		__entry->car = car;
+		__entry->old_state = old_state;
+		__entry->new_state = new_state;
+	),
+	TP_printk("car=%d %s -> %s", __entry->car,
+		show_state(__entry->old_state), show_state(__entry->new_state))
+);
+
+#endif /* _ELEVATOR_TRACE_H */
+
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE elevator_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,149 @@
+#ifndef __ELEVATOR_UAPI_H
+#define __ELEVATOR_UAPI_H
+
+/* Types shared between the elevator module and its userspace tools */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* largest number of requests accepted by one issue_request_batch() call */
+#define ELEVATOR_BATCH_MAX 1024
+
+/* one entry of an issue_request_batch() array, or one record of a 
+write() to /dev/elevator */
+struct elevator_request {
+	__s32 start; /* start floor */
+	__s32 dest; /* destination floor */
+	__s32 type; /* 0 grape, 1 sheep, 2 wolf */
+	__s32 status; /* out: 0 queued, 1 rejected, or a negative errno */
+	__u32 id; /* out: the passenger's id in events, if queued */
+};
+
+/* The /dev/elevator control device works on any kernel, without the 
+system calls.
+ - write() takes whole struct elevator_request records, at most 
+   ELEVATOR_BATCH_MAX per call, queues them like issue_request_batch() 
+   and returns the bytes consumed. Each record's outcome comes back to 
+   the same file as an ELEVATOR_EVENT_REQUEST event.
+ - read() returns whole struct elevator_event records: every board and 
+   deliver that happens while the file is open, in order, plus the 
+   outcome of the file's own writes. It blocks for the first one unless 
+   the file is O_NONBLOCK, and poll()/epoll report POLLIN while any are 
+   queued. A reader that falls too far behind gets one 
+   ELEVATOR_EVENT_LOST record, with the number it missed in id, in their 
+   place. A passenger the elevator stops without delivering, still 
+   waiting or put off early by a fast stop, gets ELEVATOR_EVENT_DROP with 
+   the floor they were left on.
+ - ioctl() starts and stops the elevator, reads and changes its 
+   configuration and picks the kinds of events the file receives. */
+#define ELEVATOR_EVENT_BOARD 1
+#define ELEVATOR_EVENT_DELIVER 2
+#define ELEVATOR_EVENT_LOST 3
+#define ELEVATOR_EVENT_REQUEST 4
+#define ELEVATOR_EVENT_DROP 5
+
+struct elevator_event {
+	__u32 id; /* passenger id from issue_request_batch() or write() */
+	__u32 kind; /* ELEVATOR_EVENT_* */
+	__u32 car; /* 1-based; 0 for REQUEST */
+	__s32 floor; /* where the passenger boarded, got off or was left, or 
+	starts */
+	__s32 status; /* REQUEST: as elevator_request.status */
+	__u32 index; /* REQUEST: the record's position in its write() */
+	__u64 time_ns; /* CLOCK_MONOTONIC */
+};
+
+/* ELEVATOR_IOC_GET_CONFIG and ELEVATOR_IOC_SET_CONFIG: the module 
+parameters. num_cars, num_floors and capacity are fixed at load, and 
+SET_CONFIG fails with EINVAL if they differ; it needs CAP_SYS_ADMIN. */
+#define ELEVATOR_POLICY_LOOK 0
+#define ELEVATOR_POLICY_SCAN 1
+#define ELEVATOR_POLICY_SSTF 2
+#define ELEVATOR_POLICY_GREEDY 3
+
+struct elevator_config {
+	__u32 num_cars;
+	__u32 num_floors;
+	__u32 capacity;
+	__u32 floor_ms;
+	__u32 load_ms;
+	__u32 idle_poll_ms;
+	__u32 time_compression;
+	__u32 policy; /* ELEVATOR_POLICY_* */
+	__u32 optimise_boarding;
+	__u32 max_skips;
+	__u32 park;
+	__u32 max_waiting;
+	__u32 max_waiting_per_floor;
+	__u32 passenger_budget_kb;
+};
+
+/* START fails with EBUSY if the elevator runs, STOP with EALREADY if it 
+is stopped or stopping. STOP waits until every rider is delivered (or 
+put off at the next floor, with the fast_stop parameter set); STOP_FAST 
+always puts them off, and also hurries a STOP under way. Both fail with 
+EINTR if a signal interrupts the wait, and the elevator goes on stopping. 
+EVENTS takes a mask of (1 << ELEVATOR_EVENT_*), 
+all kinds by default; LOST is always delivered. */
+#define ELEVATOR_IOC_MAGIC 'E'
+#define ELEVATOR_IOC_START _IO(ELEVATOR_IOC_MAGIC, 1)
+#define ELEVATOR_IOC_STOP _IO(ELEVATOR_IOC_MAGIC, 2)
+#define ELEVATOR_IOC_GET_CONFIG _IOR(ELEVATOR_IOC_MAGIC, 3, struct elevator_config)
+#define ELEVATOR_IOC_SET_CONFIG _IOW(ELEVATOR_IOC_MAGIC, 4, struct elevator_config)
+#define ELEVATOR_IOC_EVENTS _IOW(ELEVATOR_IOC_MAGIC, 5, __u32)
+#define ELEVATOR_IOC_STOP_FAST _IO(ELEVATOR_IOC_MAGIC, 6)
+
+/* Binary statistics region, mmap-able read-only from /proc/elevator_stats.
+ The region starts with struct elevator_stats and is followed, at
+ floors_offset, by num_floors __u32 waiting counts (floor 1 first, summed
+ over all cars). Each count is updated on its own, atomically, outside
+ seq, so a copy of them may mix moments; everything before floors_offset
+ changes under seq. Samplers read seq, copy what they need and retry if
+ seq was odd or has changed:
+
+	do {
+		seq = READ_ONCE(stats->seq);
+		rmb();
+		... copy ...
+		rmb();
+	} while ((seq & 1) || seq != READ_ONCE(stats->seq));
+*/
+#define ELEVATOR_STATS_MAGIC 0x454c5654 /* "ELVT" */
+#define ELEVATOR_STATS_VERSION 1
+#define ELEVATOR_STATS_MAX_CARS 16
+
+struct elevator_stats_car {
+	__u32 state; /* 0 offline, 1 idle, 2 loading, 3 up, 4 down */
+	__s32 current_floor;
+	__s32 direction; /* 3 up, 4 down */
+	__s32 target;
+	__u32 passengers; /* on board */
+	__u32 wolves;
+	__u32 sheep;
+	__u32 grapes;
+	__u32 waiting; /* assigned to this car, not yet on board */
+	__u32 serviced;
+	__u64 floors_travelled;
+	__u64 stops;
+};
+
+struct elevator_stats {
+	__u32 magic;
+	__u32 version;
+	__u32 seq; /* odd while an update is in progress */
+	__u32 size; /* bytes of the whole region */
+	__u32 state; /* 0 offline, 1 running */
+	__u32 num_cars;
+	__u32 num_floors;
+	__u32 capacity;
+	__u32 floors_offset; /* offset of the per-floor waiting counts */
+	__u32 shed; /* requests refused by admission control, since load */
+	__u64 requests; /* cumulative, since module load */
+	__u64 rejected;
+	__u64 serviced;
+	__u64 floors_travelled;
+	__u64 stops;
+	struct elevator_stats_car cars[ELEVATOR_STATS_MAX_CARS];
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "elevator_uapi.h"
+
+/*
+ This program samples the elevator through the binary statistics page.
+ It maps /proc/elevator_stats read-only and reads it in a loop without
+ any system call per sample, printing one line per car every interval
+ and, at the end, how many samples per second it managed.
+*/
+
+#define STATS_PATH "/proc/elevator_stats"
+
+static const char *states[] = {"OFFLINE", "IDLE", "LOADING", "UP", "DOWN"};
+
+double elapsed_ms(struct timespec *t0, struct timespec *t1){
+	return (t1->tv_sec - t0->tv_sec) * 1000.0 +
+		(t1->tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+/* copy a consistent snapshot of the region into out */
+void sample(const volatile struct elevator_stats *region, char *out, size_t size){
+	unsigned int seq;
+
+	do {
+		seq = region->seq;
+		__sync_synchronize();
+		memcpy(out, (const void *)region, size);
+		__sync_synchronize();
+	} while((seq & 1) || seq != region->seq);
+}
+
+int main(int argc, char **argv){
+	const struct elevator_stats *region;
+	struct elevator_stats *stats;
+	struct timespec t0, t1, last, now;
+	long samples, count, interval_ms;
+	__u32 *waiting;
+	size_t size;
+	char *snap;
+	int fd, c, i;
+
+	if(argc > 3 || (argc > 1 && strcmp(argv[1], "--help") == 0)){
+		printf("usage: elevstat.x [print_interval_ms] [samples]\n");
+		return -1;
+	}
+	interval_ms = argc > 1 ? atol(argv[1]) : 1000;
+	samples = argc > 2 ? atol(argv[2]) : 1000000;
+
+	fd = open(STATS_PATH, O_RDONLY);
+	if(fd < 0){
+		perror(STATS_PATH);
+		return -1;
+	}
+	/* the header tells how big the whole region is */
+	region = mmap(NULL, sizeof(*region), PROT_READ, MAP_SHARED, fd, 0);
+	if(region == MAP_FAILED){
+		perror("mmap");
+		return -1;
+	}
+	if(region->magic != ELEVATOR_STATS_MAGIC ||
+			region->version != ELEVATOR_STATS_VERSION){
+		printf("unexpected stats layout\n");
+		return -1;
+	}
+	size = region->size;
+	munmap((void *)region, sizeof(*region));
+	region = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if(region == MAP_FAILED){
+		perror("mmap");
+		return -1;
+	}
+	close(fd);
+
+	snap = malloc(size);
+	if(snap == NULL)
+		return -1;
+	stats = (struct elevator_stats *)snap;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	last = t0;
+	for(count = 0; count < samples; count+=1)
+	{
+		sample(region, snap, size);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(elapsed_ms(&last, &now) < interval_ms && count < samples - 1)
+			continue;
+		last = now;
+
+		printf("requests %llu, rejected %llu (%u shed), serviced %llu, "
+			"floors travelled %llu, stops %llu\n",
+			(unsigned long long)stats->requests,
+			(unsigned long long)stats->rejected, stats->shed,
+			(unsigned long long)stats->serviced,
+			(unsigned long long)stats->floors_travelled,
+			(unsigned long long)stats->stops);
+		for(c = 0; c < (int)stats->num_cars; c+=1)
+			printf("  car %d: %s, floor %d, %u on board, %u waiting\n",
+				c + 1, states[stats->cars[c].state % 5],
+				stats->cars[c].current_floor,
+				stats->cars[c].passengers, stats->cars[c].waiting);
+		waiting = (__u32 *)(snap + stats->floors_offset);
+		printf("  waiting by floor:");
+		for(i = 0; i < (int)stats->num_floors; i+=1)
+			printf(" %u", waiting[i]);
+		printf("\n");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("%ld samples in %.1f ms (%.0f samples/s)\n", samples,
+		elapsed_ms(&t0, &t1), samples * 1000.0 / elapsed_ms(&t0, &t1));
+	return 0;
+}
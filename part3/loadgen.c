@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include "wrappers.h"
+#include "arrivals.h"
+
+/*
+ This program drives the elevator with realistic traffic. It starts T
+ producer threads that together issue N requests at a target rate drawn
+ from one of the arrival models in arrivals.h (poisson, bursty, up-peak,
+ down-peak or day), each thread replaying its own seeded stream on the
+ wall clock. It reports the achieved rate, how many requests were
+ rejected and percentiles of the time spent in issue_request().
+ With -w it also follows /dev/elevator with epoll, waits until every
+ accepted passenger has been delivered and reports percentiles of the
+ time from issue to delivery.
+ Run it with the elevator started.
+*/
+
+#define EVENTS_PATH "/dev/elevator"
+
+/* a passenger we issued, and when (CLOCK_MONOTONIC, like the events) */
+struct issued {
+	unsigned int id;
+	long ns; /* -1 if rejected */
+};
+
+struct producer {
+	pthread_t thread;
+	struct arrivals arrivals;
+	int num;
+	int rejected;
+	int behind; /* arrivals issued late because the thread fell behind */
+	long *latency_ns; /* one per request */
+	struct issued *issued; /* with -w, one per request */
+};
+
+/* the thread following the event device with -w */
+struct waiter {
+	pthread_t thread;
+	int fd;
+	struct issued *ours; /* sorted by id, set once all are issued */
+	int num_ours;
+	int matched;
+	int dropped; /* passengers the elevator stopped without delivering */
+	long lost; /* events the module dropped for us */
+	long *e2e_ns; /* issue to delivery, one per match */
+};
+
+int wait_deliveries = 0;
+
+pthread_barrier_t start_line;
+struct timespec t0;
+
+double elapsed_ms(struct timespec *t0, struct timespec *t1){
+	return (t1->tv_sec - t0->tv_sec) * 1000.0 +
+		(t1->tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+long elapsed_ns(struct timespec *t0, struct timespec *t1){
+	return (t1->tv_sec - t0->tv_sec) * 1000000000L +
+		(t1->tv_nsec - t0->tv_nsec);
+}
+
+/* sleep until ms after t0 */
+void sleep_until(double ms){
+	struct timespec at;
+	long ns;
+
+	ns = t0.tv_nsec + (long)((ms - (long)(ms / 1000) * 1000.0) * 1000000.0);
+	at.tv_sec = t0.tv_sec + (long)(ms / 1000) + ns / 1000000000L;
+	at.tv_nsec = ns % 1000000000L;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR)
+		;
+}
+
+void *produce(void *arg){
+	struct producer *p = arg;
+	struct elevator_request req;
+	struct timespec now, t1;
+	double at;
+	int i;
+
+	pthread_barrier_wait(&start_line);
+	for(i=0; i < p->num;i+=1)
+	{
+		at = arrival_next(&p->arrivals, &req);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(elapsed_ms(&t0, &now) > at + 1.0)
+			p->behind += 1;
+		else
+			sleep_until(at);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(wait_deliveries){
+			/* a batch of one reports the passenger id */
+			if(issue_request_batch(&req, 1) != 1){
+				p->rejected += 1;
+				p->issued[i].ns = -1;
+			} else {
+				p->issued[i].id = req.id;
+				p->issued[i].ns = now.tv_sec * 1000000000L + now.tv_nsec;
+			}
+		} else if(issue_request(req.start, req.dest, req.type) != 0)
+			p->rejected += 1;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		p->latency_ns[i] = elapsed_ns(&now, &t1);
+	}
+	return NULL;
+}
+
+int compare_long(const void *a, const void *b){
+	long x = *(const long *)a, y = *(const long *)b;
+	return x < y ? -1 : x > y;
+}
+
+int compare_id(const void *a, const void *b){
+	unsigned int x = ((const struct issued *)a)->id;
+	unsigned int y = ((const struct issued *)b)->id;
+	return x < y ? -1 : x > y;
+}
+
+/* Follow the event device until every passenger in w->ours has been
+ delivered or dropped by a stop (or as many events were lost). Both are
+ logged as they arrive, since they start before main() knows all of our
+ ids, and matched once it has published them; a drop is logged with no
+ time. */
+void *follow(void *arg){
+	struct waiter *w = arg;
+	struct elevator_event ev[64];
+	struct epoll_event e;
+	struct issued *log, *ours, *mine;
+	int epfd, n, i, num_log, size_log, done;
+
+	epfd = epoll_create1(0);
+	e.events = EPOLLIN;
+	e.data.fd = w->fd;
+	if(epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, w->fd, &e) != 0){
+		perror("epoll");
+		return NULL;
+	}
+	size_log = 1024;
+	log = malloc(size_log * sizeof(*log));
+	num_log = 0;
+	done = 0;
+	while(log != NULL){
+		ours = __atomic_load_n(&w->ours, __ATOMIC_ACQUIRE);
+		if(ours != NULL){
+			for(; done < num_log;done+=1){
+				mine = bsearch(&log[done], ours, w->num_ours, sizeof(*ours),
+					compare_id);
+				if(mine == NULL || mine->ns < 0)
+					continue;
+				if(log[done].ns < 0)
+					w->dropped += 1;
+				else
+					w->e2e_ns[w->matched++] = log[done].ns - mine->ns;
+			}
+			if(w->matched + w->dropped + w->lost >= w->num_ours)
+				break;
+		}
+		/* wake up now and then to notice ours being published */
+		if(epoll_wait(epfd, &e, 1, 100) <= 0)
+			continue;
+		n = read(w->fd, ev, sizeof(ev));
+		for(i=0; i < n / (int)sizeof(ev[0]);i+=1){
+			if(ev[i].kind == ELEVATOR_EVENT_LOST)
+				w->lost += ev[i].id;
+			if(ev[i].kind != ELEVATOR_EVENT_DELIVER &&
+				ev[i].kind != ELEVATOR_EVENT_DROP)
+				continue;
+			if(num_log == size_log){
+				size_log *= 2;
+				log = realloc(log, size_log * sizeof(*log));
+				if(log == NULL)
+					break;
+			}
+			log[num_log].id = ev[i].id;
+			log[num_log].ns = ev[i].kind == ELEVATOR_EVENT_DROP ? -1 :
+				(long)ev[i].time_ns;
+			num_log += 1;
+		}
+	}
+	free(log);
+	close(epfd);
+	return NULL;
+}
+
+/* the value below which pct percent of the sorted samples fall */
+long percentile(long *sorted, int count, double pct){
+	int i = (int)(count * pct / 100.0);
+	return sorted[i < count ? i : count - 1];
+}
+
+void usage(void){
+	printf("usage: loadgen.x [-t threads] [-n requests] [-r arrivals_per_minute] "
+		"[-m poisson|bursty|up-peak|down-peak|day] [-D day_minutes] "
+		"[-s seed] [-w]\n");
+}
+
+int main(int argc, char **argv){
+	struct producer *producers;
+	struct waiter waiter;
+	struct issued *ours;
+	struct timespec t1;
+	int threads, num, model, floors, opt, i, j, k, rejected, behind;
+	unsigned long long seed;
+	double rate, day_minutes, ms;
+	long *all;
+
+	threads = 4;
+	num = 1000;
+	rate = 600;
+	model = ARRIVAL_POISSON;
+	day_minutes = 60;
+	seed = 1;
+	while((opt = getopt(argc, argv, "t:n:r:m:D:s:wh")) != -1){
+		switch(opt){
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'n':
+			num = atoi(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'm':
+			model = arrival_model_parse(optarg);
+			break;
+		case 'D':
+			day_minutes = atof(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'w':
+			wait_deliveries = 1;
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if(threads < 1 || num < threads || rate <= 0 || model < 0 ||
+			day_minutes <= 0){
+		usage();
+		return -1;
+	}
+	floors = elevator_param("num_floors", 10);
+
+	producers = calloc(threads, sizeof(*producers));
+	all = malloc(num * sizeof(*all));
+	if(producers == NULL || all == NULL)
+		return -1;
+	pthread_barrier_init(&start_line, NULL, threads + 1);
+
+	/* subscribe before the first request so no delivery is missed */
+	memset(&waiter, 0, sizeof(waiter));
+	if(wait_deliveries){
+		waiter.fd = open(EVENTS_PATH, O_RDONLY | O_NONBLOCK);
+		waiter.e2e_ns = malloc(num * sizeof(long));
+		if(waiter.fd < 0 || waiter.e2e_ns == NULL){
+			perror(EVENTS_PATH);
+			return -1;
+		}
+		pthread_create(&waiter.thread, NULL, follow, &waiter);
+	}
+
+	/* the streams add up to the target rate; each has its own seed */
+	for(i=0; i < threads;i+=1){
+		producers[i].num = num / threads + (i < num % threads);
+		arrivals_init(&producers[i].arrivals, model, rate / threads, floors,
+			seed + i);
+		producers[i].arrivals.day_ms = day_minutes * 60000.0;
+		producers[i].latency_ns = malloc(producers[i].num * sizeof(long));
+		producers[i].issued = calloc(producers[i].num, sizeof(struct issued));
+		if(producers[i].latency_ns == NULL || producers[i].issued == NULL)
+			return -1;
+		pthread_create(&producers[i].thread, NULL, produce, &producers[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_barrier_wait(&start_line);
+	rejected = 0;
+	behind = 0;
+	k = 0;
+	ours = malloc(num * sizeof(*ours));
+	if(ours == NULL)
+		return -1;
+	for(i=0; i < threads;i+=1){
+		pthread_join(producers[i].thread, NULL);
+		rejected += producers[i].rejected;
+		behind += producers[i].behind;
+		for(j=0; j < producers[i].num;j+=1){
+			if(producers[i].issued[j].ns >= 0)
+				ours[waiter.num_ours++] = producers[i].issued[j];
+			all[k++] = producers[i].latency_ns[j];
+		}
+		free(producers[i].latency_ns);
+		free(producers[i].issued);
+	}
+	if(wait_deliveries){
+		qsort(ours, waiter.num_ours, sizeof(*ours), compare_id);
+		__atomic_store_n(&waiter.ours, ours, __ATOMIC_RELEASE);
+		pthread_join(waiter.thread, NULL);
+		close(waiter.fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	qsort(all, num, sizeof(*all), compare_long);
+
+	ms = elapsed_ms(&t0, &t1);
+	printf("model: %s\n", arrival_model_names[model]);
+	printf("threads: %d\n", threads);
+	printf("floors: %d\n", floors);
+	printf("seed: %llu\n", seed);
+	printf("requests: %d\n", num);
+	printf("rejected: %d\n", rejected);
+	printf("late: %d\n", behind);
+	printf("elapsed_ms: %.3f\n", ms);
+	printf("target_per_minute: %.1f\n", rate);
+	printf("achieved_per_minute: %.1f\n", ms > 0 ? num * 60000.0 / ms : 0.0);
+	printf("latency_us: p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+		percentile(all, num, 50) / 1000.0, percentile(all, num, 90) / 1000.0,
+		percentile(all, num, 99) / 1000.0, percentile(all, num, 99.9) / 1000.0,
+		all[num - 1] / 1000.0);
+	if(wait_deliveries && waiter.matched > 0){
+		qsort(waiter.e2e_ns, waiter.matched, sizeof(long), compare_long);
+		printf("delivered: %d\n", waiter.matched);
+		printf("dropped: %d\n", waiter.dropped);
+		printf("events_lost: %ld\n", waiter.lost);
+		printf("e2e_ms: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+			percentile(waiter.e2e_ns, waiter.matched, 50) / 1e6,
+			percentile(waiter.e2e_ns, waiter.matched, 90) / 1e6,
+			percentile(waiter.e2e_ns, waiter.matched, 99) / 1e6,
+			waiter.e2e_ns[waiter.matched - 1] / 1e6);
+	}
+
+	pthread_barrier_destroy(&start_line);
+	free(waiter.e2e_ns);
+	free(ours);
+	free(all);
+	free(producers);
+	return 0;
+}
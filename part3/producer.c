@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "wrappers.h"
 
@@ -7,30 +8,88 @@ int rnd(int min, int max){
 	return rand() % (max - min + 1) + min; //slight bias towards first k
 }
 
+double elapsed_ms(struct timespec *t0, struct timespec *t1){
+	return (t1->tv_sec - t0->tv_sec) * 1000.0 +
+		(t1->tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
 int main(int argc, char **argv){
-	int type;
-	int start;
-	int dest;
+	struct elevator_request *reqs;
+	struct timespec t0, t1;
 	int i;
 	int num;
+	int floors;
+	int batch = 0;
+	int queued = 0;
+	double ms;
 	srand(time(0));
 
-	if(argc != 2){
-		printf("wrong number of args. producer.x num_of_requests\n");
+	if(argc == 4 && strcmp(argv[2], "--batch") == 0){
+		sscanf(argv[3], "%d", &batch);
+		if(batch < 1 || batch > ELEVATOR_BATCH_MAX){
+			printf("batch size must be between 1 and %d\n", ELEVATOR_BATCH_MAX);
+			return -1;
+		}
+	}
+	else if(argc != 2){
+		printf("wrong number of args. producer.x num_of_requests [--batch N]\n");
 		return -1;
 	}
 	sscanf(argv[1], "%d",&num);
+	if(num < 1){
+		printf("num_of_requests must be positive\n");
+		return -1;
+	}
+
+	/* spread passengers over the building the module was loaded with */
+	floors = elevator_param("num_floors", 10);
+
+	/* generate every request up front so only the syscalls are timed */
+	reqs = malloc(num * sizeof(*reqs));
+	if(reqs == NULL)
+		return -1;
 	for(i=0; i < num;i+=1)
 	{
-		type = rnd(0,2);
+		reqs[i].type = rnd(0,2);
 
-		start = rnd(1, 10);
+		reqs[i].start = rnd(1, floors);
 		do {
-			dest = rnd(1, 10);
-		} while(dest == start);
+			reqs[i].dest = rnd(1, floors);
+		} while(reqs[i].dest == reqs[i].start);
+	}
 
-		long ret = issue_request(start, dest, type);
-		printf("Issue (%d, %d, %d) returned %ld\n", start, dest, type, ret);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(batch == 0){
+		/* one syscall per passenger */
+		for(i=0; i < num;i+=1)
+			reqs[i].status = issue_request(reqs[i].start, reqs[i].dest, reqs[i].type);
+	}
+	else {
+		/* up to batch passengers per syscall */
+		for(i=0; i < num;i+=batch){
+			int count = num - i < batch ? num - i : batch;
+			long ret = issue_request_batch(reqs + i, count);
+			if(ret < 0){
+				int j;
+				for(j=i; j < i + count;j+=1)
+					reqs[j].status = ret;
+			}
+		}
 	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	for(i=0; i < num;i+=1)
+	{
+		printf("Issue (%d, %d, %d) returned %d\n", reqs[i].start, reqs[i].dest,
+			reqs[i].type, reqs[i].status);
+		if(reqs[i].status == 0)
+			queued += 1;
+	}
+
+	ms = elapsed_ms(&t0, &t1);
+	printf("%d of %d requests queued in %.3f ms (%.0f requests/s, %s)\n",
+		queued, num, ms, ms > 0 ? num * 1000.0 / ms : 0.0,
+		batch == 0 ? "one at a time" : "batched");
+	free(reqs);
 	return 0;
 }
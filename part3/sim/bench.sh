@@ -0,0 +1,70 @@
+#!/bin/sh
+# Benchmark suite: runs every named scenario through elevsim.x and prints
+# one "scenario metric value" line per figure, sorted, so reports diff
+# cleanly. The simulator is deterministic, so any change in a figure is a
+# change in behaviour.
+#
+# usage: bench.sh [-P policy]             print a report
+#        bench.sh -c baseline report      compare two reports
+#
+# Wait times come from the log2 latency histograms, so wait_p99_ms is a
+# bucket upper bound.
+
+ELEVSIM=${ELEVSIM:-./elevsim.x}
+
+# name and elevsim.x options; all run 2 cars, 1000 passengers, seed 1
+scenarios() {
+	cat <<EOF
+light -m poisson -r 10
+up-peak -m up-peak -r 60
+down-peak -m down-peak -r 60
+wolf-heavy -m poisson -r 40 -w 1,1,4
+capacity-saturated -m poisson -r 120 -o capacity=4
+EOF
+}
+
+METRICS="serviced_per_minute wait_mean_ms wait_p99_ms floors_per_passenger stops"
+
+report() {
+	scenarios | while read -r name args; do
+		# shellcheck disable=SC2086
+		$ELEVSIM -c 2 -n 1000 -s 1 $args "$@" > /tmp/bench.$$ || exit 1
+		for m in $METRICS; do
+			printf "%s %s %s\n" "$name" "$m" \
+				"$(sed -n "s/^$m: //p" /tmp/bench.$$)"
+		done
+	done | sort
+	rm -f /tmp/bench.$$
+}
+
+# print every figure with its change against the baseline; exit 1 if
+# any differ
+compare() {
+	join -j1 -o 1.2,1.3,1.4,2.4 \
+		"$(keyed "$1" a)" "$(keyed "$2" b)" | awk '
+	{
+		delta = $3 == 0 ? 0 : ($4 - $3) * 100.0 / $3
+		mark = $3 == $4 ? "" : "  *"
+		if ($3 != $4)
+			changed = 1
+		printf "%-20s %-22s %14s %14s %+8.2f%%%s\n", $1, $2, $3, $4, \
+			delta, mark
+	}
+	END { exit changed }'
+}
+
+# copy of report $1 keyed by scenario/metric for join, named after $2
+keyed() {
+	out=/tmp/bench.$$.$2
+	awk '{ print $1 "/" $2, $0 }' "$1" | sort > "$out"
+	echo "$out"
+}
+
+if [ "$1" = "-c" ]; then
+	[ $# -eq 3 ] || { echo "usage: bench.sh -c baseline report"; exit 2; }
+	compare "$2" "$3"
+	status=$?
+	rm -f /tmp/bench.$$.*
+	exit $status
+fi
+report "$@"
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include "sim.h"
+#include "../arrivals.h"
+
+/*
+ This program replays a random passenger workload against the elevator
+ module on a virtual clock and reports throughput. It draws arrivals from
+ the same models as loadgen.c, issues them through the simulated syscall
+ entry points, and finishes once every accepted passenger has been
+ serviced. With -e it also follows /dev/elevator and waits for the
+ deliver events rather than sampling the stats page; with -d it drives
+ the elevator through the device's ioctls and writes instead of the
+ system calls.
+*/
+
+#define PROC_BUF_SIZE (1 << 20)
+
+/* read a "key value" figure from the line of buf starting with line */
+static long proc_field(const char *buf, const char *line, const char *key) {
+	const char *p, *end;
+
+	p = strstr(buf, line);
+	if (p == NULL) {
+		return -1;
+	}
+	end = strchr(p, '\n');
+	p = strstr(p, key);
+	if (p == NULL || (end != NULL && p > end)) {
+		return -1;
+	}
+	return atol(p + strlen(key));
+}
+
+/* copy the header of the mmap'ed stats region, retrying while the 
+module is updating it */
+static void stats_sample(const struct elevator_stats *region, 
+struct elevator_stats *out) {
+	unsigned int seq;
+
+	do {
+		seq = __atomic_load_n(&region->seq, __ATOMIC_ACQUIRE);
+		memcpy(out, (const void *)region, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&region->seq, 
+		__ATOMIC_RELAXED));
+}
+
+#define NUM_EVENT_KINDS 6
+
+/* tally the events that can be read from dev without blocking, or wait 
+for at least one if block is set. Requests count if they were queued. */
+static void read_events(struct sim_dev *dev, int block, 
+long counts[NUM_EVENT_KINDS]) {
+	struct elevator_event ev[64];
+	long n, i;
+
+	while (block || (sim_dev_poll(dev) & 1)) {
+		n = sim_dev_read(dev, ev, sizeof(ev));
+		if (n <= 0) {
+			return;
+		}
+		for (i = 0; i < n / (long)sizeof(ev[0]); ++i) {
+			if (ev[i].kind == ELEVATOR_EVENT_REQUEST && ev[i].status != 0) {
+				continue;
+			}
+			counts[ev[i].kind < NUM_EVENT_KINDS ? ev[i].kind : 0] += 
+				ev[i].kind == ELEVATOR_EVENT_LOST ? ev[i].id : 1;
+		}
+		block = 0;
+	}
+}
+
+static void usage(void) {
+	printf("usage: elevsim.x [-n passengers] [-r arrivals_per_minute] "
+		"[-b batch] [-c cars] [-P policy] [-m model] [-D day_minutes] "
+		"[-w grape,sheep,wolf] "
+		"[-x time_compression] "
+		"[-o param=value]... [-s seed] [-e] [-d] [-p] [-t] [-v]\n");
+}
+
+int main(int argc, char **argv) {
+	int opt, num, batch, pending, accepted, print_proc, floors, i;
+	struct sim_dev *events;
+	long event_counts[NUM_EVENT_KINDS];
+	int follow_events, use_dev;
+	unsigned int mask;
+	const struct elevator_stats *region;
+	struct elevator_stats stats;
+	struct elevator_request reqs[ELEVATOR_BATCH_MAX];
+	double rate, arrival, day_minutes;
+	struct arrivals arrivals;
+	unsigned long long seed, end;
+	struct timespec t0, t1;
+	char *buf, *cars, *policy, *params[16], *value;
+	int num_params, compression, model, weights[3];
+	long ret;
+
+	num = 1000;
+	rate = 30.0;
+	batch = 1;
+	cars = "1";
+	policy = "look";
+	seed = 1;
+	print_proc = 0;
+	follow_events = 0;
+	use_dev = 0;
+	memset(event_counts, 0, sizeof(event_counts));
+	events = NULL;
+	compression = 1;
+	num_params = 0;
+	model = ARRIVAL_POISSON;
+	day_minutes = 24 * 60;
+	weights[0] = weights[1] = weights[2] = 1;
+	while ((opt = getopt(argc, argv, "n:r:b:c:P:m:D:w:x:o:s:edptvh")) != -1) {
+		switch (opt) {
+		case 'n':
+			num = atoi(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'c':
+			cars = optarg;
+			break;
+		case 'P':
+			policy = optarg;
+			break;
+		case 'm':
+			model = arrival_model_parse(optarg);
+			if (model < 0) {
+				printf("unknown arrival model %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'D':
+			day_minutes = atof(optarg);
+			break;
+		case 'w':
+			/* relative odds of each passenger type */
+			if (sscanf(optarg, "%d,%d,%d", &weights[0], &weights[1], 
+					&weights[2]) != 3 || weights[0] < 0 || weights[1] < 0 || 
+					weights[2] < 0 || weights[0] + weights[1] + weights[2] == 0) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'x':
+			compression = atoi(optarg);
+			break;
+		case 'o':
+			if (num_params == 16 || strchr(optarg, '=') == NULL) {
+				usage();
+				return -1;
+			}
+			params[num_params++] = optarg;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'e':
+			follow_events = 1;
+			break;
+		case 'd':
+			use_dev = 1;
+			break;
+		case 'p':
+			print_proc = 1;
+			break;
+		case 't':
+			sim_set_tracing(1);
+			break;
+		case 'v':
+			sim_set_verbose(1);
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (num < 0 || rate <= 0 || batch < 1 || batch > ELEVATOR_BATCH_MAX || 
+			compression < 1 || day_minutes <= 0) {
+		usage();
+		return -1;
+	}
+
+	buf = malloc(PROC_BUF_SIZE);
+	if (buf == NULL) {
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	sim_init();
+	sim_set_param("num_cars", cars);
+	if (sim_set_param("policy", policy) != 0) {
+		printf("unknown policy %s\n", policy);
+		return -1;
+	}
+	for (i = 0; i < num_params; ++i) {
+		value = strchr(params[i], '=');
+		*value++ = '\0';
+		if (sim_set_param(params[i], value) != 0) {
+			printf("cannot set %s to %s\n", params[i], value);
+			return -1;
+		}
+	}
+	/* -x is a shorthand for -o time_compression=N, set once the timings 
+	it is checked against are; arrivals are compressed by the same 
+	factor below */
+	sprintf(buf, "%d", compression);
+	if (sim_set_param("time_compression", buf) != 0) {
+		printf("time_compression %d would make a floor or stop shorter "
+			"than a jiffy\n", compression);
+		return -1;
+	}
+	if (sim_module_init() != 0) {
+		printf("module init failed\n");
+		return -1;
+	}
+	region = sim_proc_mmap("elevator_stats", sizeof(*region));
+	if (region == NULL || region->magic != ELEVATOR_STATS_MAGIC) {
+		printf("cannot map /proc/elevator_stats\n");
+		return -1;
+	}
+	/* the building as the module was configured, like producer.c */
+	floors = region->num_floors;
+	arrivals_init(&arrivals, model, rate, floors, seed);
+	arrivals.day_ms = day_minutes * 60000.0;
+	memcpy(arrivals.type_weights, weights, sizeof(weights));
+	if (follow_events || use_dev) {
+		events = sim_dev_open("elevator", 0);
+		if (events == NULL) {
+			printf("cannot open /dev/elevator\n");
+			return -1;
+		}
+		/* just the outcome of our own writes, unless following */
+		mask = follow_events ? ~0U : 1U << ELEVATOR_EVENT_REQUEST;
+		sim_dev_ioctl(events, ELEVATOR_IOC_EVENTS, &mask);
+	}
+	ret = use_dev ? sim_dev_ioctl(events, ELEVATOR_IOC_START, NULL) : 
+		my_start_elevator();
+	if (ret != 0) {
+		printf("start_elevator returned %ld\n", ret);
+		return -1;
+	}
+
+	/* arrivals at the requested rate. With -b, arrivals are held back 
+	and submitted together once the batch is full. */
+	accepted = 0;
+	pending = 0;
+	arrival = 0;
+	for (i = 0; i < num; ++i) {
+		arrival = arrival_next(&arrivals, &reqs[pending]);
+		pending += 1;
+
+		if (pending < batch && i < num - 1) {
+			continue;
+		}
+		sim_sleep_until_ms((unsigned long long)(arrival / compression));
+		if (use_dev) {
+			/* queued requests are counted from their events below */
+			sim_dev_write(events, reqs, pending * sizeof(reqs[0]));
+		} else if (batch == 1) {
+			if (my_issue_request(reqs[0].start, reqs[0].dest, 
+					reqs[0].type) == 0) {
+				accepted += 1;
+			}
+		} else {
+			ret = my_issue_request_batch(reqs, pending);
+			if (ret > 0) {
+				accepted += ret;
+			}
+		}
+		pending = 0;
+		if (events != NULL) {
+			read_events(events, 0, event_counts);
+		}
+	}
+	if (use_dev) {
+		accepted = event_counts[ELEVATOR_EVENT_REQUEST];
+	}
+
+	/* block on the event device until everyone is delivered; if events 
+	were lost, the stats page below has the final word */
+	while (follow_events && event_counts[ELEVATOR_EVENT_LOST] == 0 && 
+			event_counts[ELEVATOR_EVENT_DELIVER] < accepted) {
+		read_events(events, 1, event_counts);
+	}
+
+	/* sample the stats page once a building second until everyone is 
+	delivered */
+	do {
+		sim_sleep_until_ms(sim_now_ms() + (compression < 1000 ? 1000 / compression : 1));
+		stats_sample(region, &stats);
+	} while (stats.serviced < (unsigned long long)accepted);
+	end = sim_now_ms();
+
+	if (print_proc) {
+		sim_proc_read("elevator", buf, PROC_BUF_SIZE);
+		fputs(buf, stdout);
+		putchar('\n');
+	}
+	sim_proc_read("elevator_latency", buf, PROC_BUF_SIZE);
+
+	if (use_dev) {
+		sim_dev_ioctl(events, ELEVATOR_IOC_STOP, NULL);
+	} else {
+		my_stop_elevator();
+	}
+	if (events != NULL) {
+		sim_dev_close(events);
+	}
+	sim_module_exit();
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("cars: %s\n", cars);
+	printf("policy: %s\n", policy);
+	printf("model: %s\n", arrival_model_names[model]);
+	printf("passengers: %d\n", num);
+	printf("accepted: %d\n", accepted);
+	printf("serviced: %llu\n", (unsigned long long)stats.serviced);
+	printf("floors_travelled: %llu\n", 
+		(unsigned long long)stats.floors_travelled);
+	printf("stops: %llu\n", (unsigned long long)stats.stops);
+	printf("floors_per_passenger: %.3f\n", stats.serviced > 0 ? 
+		(double)stats.floors_travelled / stats.serviced : 0.0);
+	printf("wait_mean_ms: %ld\n", proc_field(buf, "wait all:", "mean "));
+	printf("wait_p99_ms: %ld\n", proc_field(buf, "wait all:", "p99 "));
+	printf("e2e_mean_ms: %ld\n", proc_field(buf, "e2e all:", "mean "));
+	/* simulated time is the module's clock; building time is that 
+	stretched back by the compression factor */
+	printf("simulated_seconds: %.1f\n", end / 1000.0);
+	printf("building_seconds: %.1f\n", end * compression / 1000.0);
+	printf("serviced_per_minute: %.3f\n", end > 0 ? 
+		stats.serviced * 60000.0 / ((double)end * compression) : 0.0);
+	if (follow_events) {
+		printf("events_boarded: %ld\n", event_counts[ELEVATOR_EVENT_BOARD]);
+		printf("events_delivered: %ld\n", 
+			event_counts[ELEVATOR_EVENT_DELIVER]);
+		printf("events_lost: %ld\n", event_counts[ELEVATOR_EVENT_LOST]);
+	}
+	printf("wall_ms: %.1f\n", (t1.tv_sec - t0.tv_sec) * 1000.0 +
+		(t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+	free(buf);
+	return 0;
+}
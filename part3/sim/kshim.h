@@ -0,0 +1,828 @@
+#ifndef __KSHIM_H
+#define __KSHIM_H
+
+/*
+ * Userspace stand-ins for the kernel interfaces used by elevator.c.
+ *
+ * Only the subset of each interface the module actually uses is provided.
+ * Threads, sleeps and locks are backed by the cooperative scheduler in
+ * sim.c, which runs one simulated task at a time and advances a virtual
+ * clock instead of sleeping for real.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+typedef unsigned char u8;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef long long s64;
+
+/* compiler and annotation helpers */
+#define __user
+#define __init
+#define __exit
+#define asmlinkage
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define READ_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
+#define min_t(type, x, y) min((type)(x), (type)(y))
+#define max_t(type, x, y) max((type)(x), (type)(y))
+#define min3(x, y, z) min(min(x, y), z)
+#define max3(x, y, z) max(max(x, y), z)
+
+static inline int kstrtouint(const char *s, unsigned int base, 
+unsigned int *res) {
+	unsigned long n;
+	char *end;
+
+	if (*s == '-') {
+		return -EINVAL;
+	}
+	errno = 0;
+	n = strtoul(s, &end, base);
+	if (end == s || (*end != '\0' && strcmp(end, "\n") != 0)) {
+		return -EINVAL;
+	}
+	if (errno != 0 || n > 0xffffffffUL) {
+		return -ERANGE;
+	}
+	*res = n;
+	return 0;
+}
+
+/* module boilerplate; the shim is the 4.19 kernel the module was 
+written for */
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(4, 19, 0)
+
+struct module;
+#define THIS_MODULE ((struct module *)NULL)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+
+#define module_init(fn) int sim_module_init(void) { return fn(); }
+#define module_exit(fn) void sim_module_exit(void) { fn(); }
+
+/* module parameters are registered by name so the driver can set them
+before sim_module_init(), like insmod arguments */
+enum sim_param_type { SIM_PARAM_INT, SIM_PARAM_UINT, SIM_PARAM_BOOL, 
+	SIM_PARAM_CB };
+
+struct kernel_param;
+
+struct kernel_param_ops {
+	int (*set)(const char *val, const struct kernel_param *kp);
+	int (*get)(char *buffer, const struct kernel_param *kp);
+};
+
+struct kernel_param {
+	const char *name;
+	const struct kernel_param_ops *ops;
+	void *arg;
+};
+
+void sim_register_param(const char *name, void *value, enum sim_param_type type);
+void sim_register_param_cb(const char *name, 
+	const struct kernel_param_ops *ops, void *arg);
+
+#define sim_param_type_int SIM_PARAM_INT
+#define sim_param_type_uint SIM_PARAM_UINT
+#define sim_param_type_bool SIM_PARAM_BOOL
+
+#define module_param(name, type, perm) \
+	static void __attribute__((constructor)) __sim_param_##name(void) { \
+		sim_register_param(#name, &name, sim_param_type_##type); \
+	}
+#define module_param_cb(name, ops, arg, perm) \
+	static void __attribute__((constructor)) __sim_param_##name(void) { \
+		sim_register_param_cb(#name, ops, arg); \
+	}
+#define MODULE_PARM_DESC(name, desc)
+
+/* string helpers */
+static inline int sysfs_streq(const char *s1, const char *s2) {
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+	if (*s1 == *s2)
+		return 1;
+	if (!*s1 && *s2 == '\n' && !s2[1])
+		return 1;
+	if (*s1 == '\n' && !s1[1] && !*s2)
+		return 1;
+	return 0;
+}
+
+/* printk */
+#define KERN_EMERG ""
+#define KERN_ALERT ""
+#define KERN_CRIT ""
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_NOTICE ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* tracepoints: TRACE_EVENT() defines trace_<name>(), which formats the 
+event with its TP_printk() and prints it when the driver turned tracing 
+on (sim_set_tracing), in the format of the ftrace text output */
+extern int sim_tracing;
+
+void sim_trace(const char *event, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+struct trace_print_flags {
+	unsigned long mask;
+	const char *name;
+};
+
+const char *sim_print_symbolic(unsigned long value, 
+	const struct trace_print_flags *symbols);
+
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define TP_STRUCT__entry(...) __VA_ARGS__
+#define __field(type, item) type item;
+#define TP_fast_assign(...) __VA_ARGS__
+#define TP_printk(fmt, ...) fmt, ##__VA_ARGS__
+#define __print_symbolic(value, ...) sim_print_symbolic(value, \
+	(const struct trace_print_flags[]){ __VA_ARGS__, { 0, NULL } })
+
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	struct trace_event_raw_##name { tstruct }; \
+	static inline void trace_##name(proto) { \
+		struct trace_event_raw_##name __e, *__entry = &__e; \
+		if (!sim_tracing) \
+			return; \
+		assign \
+		sim_trace(#name, print); \
+	}
+
+/* error pointers */
+#define MAX_ERRNO 4095
+#define IS_ERR_VALUE(x) ((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+
+static inline void *ERR_PTR(long error) {
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr) {
+	return (long)ptr;
+}
+
+static inline int IS_ERR(const void *ptr) {
+	return IS_ERR_VALUE((unsigned long)ptr);
+}
+
+/* memory */
+typedef unsigned int gfp_t;
+#define __GFP_RECLAIM 0u
+#define GFP_KERNEL 0u
+#define __GFP_ZERO 1u
+
+static inline void *kmalloc(size_t size, gfp_t flags) {
+	(void)flags;
+	return malloc(size);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t flags) {
+	(void)flags;
+	if (size != 0 && n > (size_t)-1 / size) {
+		return NULL;
+	}
+	return malloc(n * size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags) {
+	(void)flags;
+	return calloc(n, size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags) {
+	(void)flags;
+	return calloc(1, size);
+}
+
+static inline void kfree(const void *p) {
+	free((void *)p);
+}
+
+#define kvcalloc(n, size, flags) kcalloc(n, size, flags)
+#define kvzalloc(size, flags) kzalloc(size, flags)
+#define kvfree(p) kfree(p)
+
+/* slab caches map straight onto malloc */
+struct kmem_cache {
+	size_t size;
+};
+
+#define SLAB_HWCACHE_ALIGN 0x2000u
+
+static inline struct kmem_cache *kmem_cache_create(const char *name,
+size_t size, size_t align, unsigned long flags, void (*ctor)(void *)) {
+	struct kmem_cache *cache;
+
+	(void)name;
+	(void)align;
+	(void)flags;
+	(void)ctor;
+	cache = malloc(sizeof(*cache));
+	if (cache != NULL) {
+		cache->size = size;
+	}
+	return cache;
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache *cache) {
+	free(cache);
+}
+
+static inline void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t flags) {
+	(void)flags;
+	return malloc(cache->size);
+}
+
+static inline void kmem_cache_free(struct kmem_cache *cache, void *p) {
+	(void)cache;
+	free(p);
+}
+
+static inline unsigned long copy_to_user(void __user *to, const void *from,
+unsigned long n) {
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from,
+unsigned long n) {
+	memcpy(to, from, n);
+	return 0;
+}
+
+#define get_user(x, ptr) ((x) = *(ptr), 0)
+
+/* the simulated caller holds every capability */
+#define CAP_SYS_ADMIN 21
+#define capable(cap) 1
+
+/* doubly linked lists (same layout and semantics as <linux/list.h>) */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+struct list_head *next) {
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head) {
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head) {
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry) {
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline void list_move_tail(struct list_head *entry, 
+struct list_head *head) {
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	list_add_tail(entry, head);
+}
+
+static inline int list_empty(const struct list_head *head) {
+	return head->next == head;
+}
+
+static inline void list_splice_tail_init(struct list_head *list,
+struct list_head *head) {
+	struct list_head *first, *last;
+
+	if (list_empty(list)) {
+		return;
+	}
+	first = list->next;
+	last = list->prev;
+	first->prev = head->prev;
+	head->prev->next = first;
+	last->next = head;
+	head->prev = last;
+	INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+
+#define list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head); \
+		pos = n, n = pos->next)
+
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry((head)->next, __typeof__(*pos), member); \
+		&pos->member != (head); \
+		pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+/* simulated tasks (kthreads) */
+struct task_struct;
+
+struct task_struct *sim_kthread_run(int (*fn)(void *), void *data,
+const char *namefmt, ...);
+#define kthread_run(fn, data, ...) sim_kthread_run(fn, data, __VA_ARGS__)
+int kthread_stop(struct task_struct *task);
+int kthread_should_stop(void);
+int wake_up_process(struct task_struct *task);
+
+/* sleeping advances the virtual clock */
+void msleep(unsigned int msecs);
+
+static inline void ssleep(unsigned int seconds) {
+	msleep(seconds * 1000);
+}
+
+/* time reads the virtual clock */
+typedef s64 ktime_t;
+
+ktime_t ktime_get(void);
+
+static inline s64 ktime_to_ns(ktime_t t) {
+	return t;
+}
+
+static inline s64 ktime_ms_delta(ktime_t later, ktime_t earlier) {
+	return (later - earlier) / 1000000;
+}
+
+static inline ktime_t ktime_add_ms(ktime_t kt, u64 ms) {
+	return kt + (s64)ms * 1000000;
+}
+
+static inline ktime_t ktime_add_ns(ktime_t kt, u64 ns) {
+	return kt + (s64)ns;
+}
+
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) {
+	return a - b;
+}
+
+static inline s64 ktime_us_delta(ktime_t later, ktime_t earlier) {
+	return (later - earlier) / 1000;
+}
+
+#define NSEC_PER_MSEC 1000000L
+#define USEC_PER_MSEC 1000L
+
+/* arithmetic */
+#define ilog2(n) (63 - __builtin_clzll((unsigned long long)(n)))
+#define div64_u64(a, b) ((u64)(a) / (u64)(b))
+#define div64_s64(a, b) ((s64)(a) / (s64)(b))
+
+/* bitmaps; the cooperative scheduler makes the plain forms atomic */
+#define BITS_PER_LONG (8 * (int)sizeof(long))
+#define BITS_TO_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+#define BIT(nr) (1UL << (nr))
+#define BIT_WORD(nr) ((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
+
+static inline void __set_bit(int nr, unsigned long *addr) {
+	addr[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void __clear_bit(int nr, unsigned long *addr) {
+	addr[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+#define set_bit(nr, addr) __set_bit(nr, addr)
+#define clear_bit(nr, addr) __clear_bit(nr, addr)
+
+static inline int test_bit(int nr, const unsigned long *addr) {
+	return (addr[BIT_WORD(nr)] & BIT_MASK(nr)) != 0;
+}
+
+static inline void bitmap_zero(unsigned long *dst, unsigned int nbits) {
+	memset(dst, 0, BITS_TO_LONGS(nbits) * sizeof(long));
+}
+
+/* number of set bits below nbits */
+static inline int bitmap_weight(const unsigned long *src, unsigned int nbits) {
+	unsigned int i;
+	int n;
+
+	n = 0;
+	for (i = 0; i < nbits; ++i) {
+		n += test_bit(i, src);
+	}
+	return n;
+}
+
+/* first set bit at or after offset, or size */
+static inline unsigned long find_next_bit(const unsigned long *addr, 
+unsigned long size, unsigned long offset) {
+	unsigned long word;
+
+	while (offset < size) {
+		word = addr[BIT_WORD(offset)] >> (offset % BITS_PER_LONG);
+		if (word != 0) {
+			offset += __builtin_ctzl(word);
+			return offset < size ? offset : size;
+		}
+		offset = (BIT_WORD(offset) + 1) * BITS_PER_LONG;
+	}
+	return size;
+}
+
+/* last set bit below size, or size */
+static inline unsigned long find_last_bit(const unsigned long *addr, 
+unsigned long size) {
+	unsigned long word, i;
+
+	i = size;
+	while (i > 0) {
+		word = addr[BIT_WORD(i - 1)];
+		if ((i % BITS_PER_LONG) != 0) {
+			word &= (1UL << (i % BITS_PER_LONG)) - 1;
+		}
+		if (word != 0) {
+			return BIT_WORD(i - 1) * BITS_PER_LONG + 
+				(BITS_PER_LONG - 1 - __builtin_clzl(word));
+		}
+		i = BIT_WORD(i - 1) * BITS_PER_LONG;
+	}
+	return size;
+}
+
+/* wait queues */
+typedef struct wait_queue_head {
+	struct task_struct *head;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq) {
+	wq->head = NULL;
+}
+
+void sim_wait_on(wait_queue_head_t *wq);
+long sim_wait_on_timeout(wait_queue_head_t *wq, long ms);
+void sim_wake_all(wait_queue_head_t *wq);
+
+/* jiffies are milliseconds */
+#define HZ 1000
+#define msecs_to_jiffies(ms) ((unsigned long)(ms))
+#define TICK_NSEC 1000000UL
+#define nsecs_to_jiffies(ns) ((unsigned long)((u64)(ns) / TICK_NSEC))
+
+/* simulated kthreads never have signals pending, so these always return 0 */
+#define wait_event(wq, condition) \
+	do { \
+		while (!(condition)) \
+			sim_wait_on(&(wq)); \
+	} while (0)
+
+#define wait_event_interruptible(wq, condition) \
+	({ wait_event(wq, condition); 0; })
+
+#define wait_event_interruptible_timeout(wq, condition, timeout) \
+	({ \
+		long __left = (timeout); \
+		while (!(condition) && __left > 0) \
+			__left = sim_wait_on_timeout(&(wq), __left); \
+		(condition) ? (__left > 0 ? __left : 1) : 0; \
+	})
+
+#define wake_up(wq) sim_wake_all(wq)
+#define wake_up_interruptible(wq) sim_wake_all(wq)
+
+/* atomics: plain ints are enough on the simulated uniprocessor */
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i) { (i) }
+#define atomic_read(v) READ_ONCE((v)->counter)
+#define atomic_set(v, i) WRITE_ONCE((v)->counter, (i))
+#define atomic_add(i, v) ((v)->counter += (i))
+#define atomic_sub(i, v) ((v)->counter -= (i))
+#define atomic_inc(v) atomic_add(1, v)
+#define atomic_dec(v) atomic_sub(1, v)
+#define atomic_dec_and_test(v) (--(v)->counter == 0)
+#define atomic_add_return(i, v) ((v)->counter += (i))
+#define atomic_inc_return(v) atomic_add_return(1, v)
+
+static inline int atomic_xchg(atomic_t *v, int new) {
+	int ret = v->counter;
+
+	v->counter = new;
+	return ret;
+}
+
+static inline int atomic_cmpxchg(atomic_t *v, int old, int new) {
+	int ret = v->counter;
+
+	if (ret == old)
+		v->counter = new;
+	return ret;
+}
+
+/* ordering is implied: tasks only switch at blocking points */
+#define smp_load_acquire(p) READ_ONCE(*(p))
+#define smp_store_release(p, v) WRITE_ONCE(*(p), (v))
+#define smp_wmb() __asm__ __volatile__("" ::: "memory")
+#define smp_rmb() __asm__ __volatile__("" ::: "memory")
+#define smp_mb__after_atomic() __asm__ __volatile__("" ::: "memory")
+
+/* sequence counters: a reader only retries if it was switched out while 
+a writer was mid-update, which the cooperative scheduler never does */
+typedef struct {
+	unsigned int sequence;
+} seqcount_t;
+
+#define seqcount_init(s) ((s)->sequence = 0)
+#define read_seqcount_begin(s) READ_ONCE((s)->sequence)
+#define read_seqcount_retry(s, start) ((s)->sequence != (start))
+#define write_seqcount_begin(s) ((s)->sequence += 1)
+#define write_seqcount_end(s) ((s)->sequence += 1)
+#define preempt_disable() do { } while (0)
+#define preempt_enable() do { } while (0)
+
+/* spinlocks: only one simulated task runs at a time and tasks never sleep
+with a spinlock held, so there is nothing to spin on */
+typedef struct spinlock {
+	int locked;
+} spinlock_t;
+
+#define spin_lock_init(lock) ((lock)->locked = 0)
+#define spin_lock(lock) ((lock)->locked = 1)
+#define spin_unlock(lock) ((lock)->locked = 0)
+#define DEFINE_SPINLOCK(name) spinlock_t name = { 0 }
+
+/* mutexes: waiters block on the mutex until it is released */
+struct mutex {
+	int locked;
+	wait_queue_head_t waiters;
+};
+
+static inline void mutex_init(struct mutex *m) {
+	m->locked = 0;
+	init_waitqueue_head(&m->waiters);
+}
+
+static inline void mutex_destroy(struct mutex *m) {
+	(void)m;
+}
+
+static inline void mutex_lock(struct mutex *m) {
+	while (m->locked)
+		sim_wait_on(&m->waiters);
+	m->locked = 1;
+}
+
+static inline void mutex_unlock(struct mutex *m) {
+	m->locked = 0;
+	sim_wake_all(&m->waiters);
+}
+
+#define DEFINE_MUTEX(name) struct mutex name = { 0, { NULL } }
+
+/* read-write semaphores */
+struct rw_semaphore {
+	int readers;
+	int writer;
+	wait_queue_head_t waiters;
+};
+
+static inline void init_rwsem(struct rw_semaphore *sem) {
+	sem->readers = 0;
+	sem->writer = 0;
+	init_waitqueue_head(&sem->waiters);
+}
+
+static inline void down_read(struct rw_semaphore *sem) {
+	while (sem->writer)
+		sim_wait_on(&sem->waiters);
+	sem->readers += 1;
+}
+
+static inline int down_read_trylock(struct rw_semaphore *sem) {
+	if (sem->writer)
+		return 0;
+	sem->readers += 1;
+	return 1;
+}
+
+static inline void up_read(struct rw_semaphore *sem) {
+	sem->readers -= 1;
+	sim_wake_all(&sem->waiters);
+}
+
+static inline void down_write(struct rw_semaphore *sem) {
+	while (sem->writer || sem->readers > 0)
+		sim_wait_on(&sem->waiters);
+	sem->writer = 1;
+}
+
+static inline void up_write(struct rw_semaphore *sem) {
+	sem->writer = 0;
+	sim_wake_all(&sem->waiters);
+}
+
+/* pages and mmap: vm_insert_page() records the kernel address of the 
+first page instead of building page tables, and the driver reads the 
+region through it (the pages of alloc_pages_exact() are contiguous) */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+#define VM_WRITE 0x2UL
+#define VM_MAYWRITE 0x20UL
+
+typedef unsigned long pgprot_t;
+
+struct vm_area_struct {
+	unsigned long vm_start;
+	unsigned long vm_end;
+	unsigned long vm_pgoff;
+	unsigned long vm_flags;
+	pgprot_t vm_page_prot;
+	void *sim_mapping;
+};
+
+void *alloc_pages_exact(size_t size, gfp_t flags);
+void free_pages_exact(void *virt, size_t size);
+struct page;
+#define virt_to_page(addr) ((struct page *)(addr))
+int vm_insert_page(struct vm_area_struct *vma, unsigned long addr, 
+	struct page *page);
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+	const void *from, size_t available);
+
+/* proc fs */
+struct inode;
+
+struct file {
+	void *private_data;
+	loff_t f_pos;
+	unsigned int f_flags; /* O_NONBLOCK */
+};
+
+/* poll: the simulator has no poll loop, callers ask sim_dev_poll() */
+typedef unsigned int __poll_t;
+typedef struct poll_table_struct poll_table;
+
+#define EPOLLIN 0x0001
+#define EPOLLRDNORM 0x0040
+
+static inline void poll_wait(struct file *file, wait_queue_head_t *wq, 
+poll_table *p) {
+}
+
+struct file_operations {
+	struct module *owner;
+	loff_t (*llseek)(struct file *, loff_t, int);
+	int (*mmap)(struct file *, struct vm_area_struct *);
+	ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+	__poll_t (*poll)(struct file *, poll_table *);
+	long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+	long (*compat_ioctl)(struct file *, unsigned int, unsigned long);
+	int (*open)(struct inode *, struct file *);
+	int (*release)(struct inode *, struct file *);
+};
+
+struct proc_dir_entry;
+
+/* seq_file: records are generated one at a time into a buffer that grows 
+when a record does not fit, as in the kernel */
+struct seq_file {
+	char *buf;
+	size_t size;
+	size_t from;
+	size_t count;
+	loff_t index;
+	const struct seq_operations *op;
+	void *private;
+};
+
+struct seq_operations {
+	void *(*start)(struct seq_file *, loff_t *);
+	void (*stop)(struct seq_file *, void *);
+	void *(*next)(struct seq_file *, void *, loff_t *);
+	int (*show)(struct seq_file *, void *);
+};
+
+#define SEQ_START_TOKEN ((void *)1)
+
+int seq_open(struct file *, const struct seq_operations *);
+ssize_t seq_read(struct file *, char __user *, size_t, loff_t *);
+loff_t seq_lseek(struct file *, loff_t, int);
+int seq_release(struct inode *, struct file *);
+int single_open(struct file *, int (*)(struct seq_file *, void *), void *);
+int single_release(struct inode *, struct file *);
+void seq_printf(struct seq_file *, const char *, ...)
+	__attribute__((format(printf, 2, 3)));
+void seq_putc(struct seq_file *, char);
+void seq_puts(struct seq_file *, const char *);
+
+struct proc_dir_entry *proc_create(const char *name, unsigned short mode,
+struct proc_dir_entry *parent, const struct file_operations *fops);
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent);
+
+/* workqueues: each has a simulated worker kthread that runs its items 
+one at a time as they fall due on the virtual clock, in the order they 
+were queued when due together */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *);
+
+struct work_struct {
+	work_func_t func;
+};
+
+struct workqueue_struct;
+
+struct delayed_work {
+	struct work_struct work;
+	struct workqueue_struct *wq;
+	u64 due; /* virtual clock, ns */
+	int pending;
+	struct delayed_work *next; /* on the workqueue, by due time */
+};
+
+#define WQ_UNBOUND 0x0002
+
+#define INIT_DELAYED_WORK(dwork, fn) \
+	do { \
+		memset((dwork), 0, sizeof(*(dwork))); \
+		(dwork)->work.func = (fn); \
+	} while (0)
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+
+struct workqueue_struct *alloc_workqueue(const char *name, unsigned int flags, 
+	int max_active);
+void destroy_workqueue(struct workqueue_struct *wq);
+bool queue_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, 
+	unsigned long delay);
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, 
+	unsigned long delay);
+bool flush_delayed_work(struct delayed_work *dwork);
+
+/* the shared queue, started on first use */
+struct workqueue_struct *sim_system_wq(void);
+#define system_wq sim_system_wq()
+#define schedule_delayed_work(dwork, delay) \
+	queue_delayed_work(system_wq, dwork, delay)
+
+/* misc devices, opened by name with sim_dev_open() */
+#define MISC_DYNAMIC_MINOR 255
+
+struct miscdevice {
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+	unsigned short mode;
+};
+
+int misc_register(struct miscdevice *);
+void misc_deregister(struct miscdevice *);
+loff_t noop_llseek(struct file *, loff_t, int);
+
+#endif
@@ -0,0 +1,1011 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include "kshim.h"
+#include "sim.h"
+
+/*
+ * Discrete-event runtime behind kshim.h.
+ *
+ * Every simulated task is backed by a pthread, but only the task that holds
+ * the "cpu" (current_task) ever runs; the others wait on their own condition
+ * variable. A task gives up the cpu only when it sleeps or blocks, so the
+ * module code sees a non-preemptive uniprocessor. When no task is runnable
+ * the virtual clock jumps straight to the earliest pending wakeup, which is
+ * what lets hours of ssleep() replay in milliseconds.
+ */
+
+enum { TASK_RUNNABLE, TASK_SLEEPING, TASK_BLOCKED, TASK_DONE };
+
+struct task_struct {
+	char name[32];
+	int (*fn)(void *);
+	void *data;
+	int state;
+	int should_stop;
+	int ret;
+	u64 wake_at; /* virtual ns, while sleeping or blocked with a timeout */
+	int timed; /* blocked with a timeout */
+	wait_queue_head_t *wq; /* queue the task is blocked on */
+	struct task_struct *wq_next;
+	wait_queue_head_t exited; /* tasks waiting in kthread_stop() */
+	pthread_t thread;
+	pthread_cond_t cond;
+	struct task_struct *next; /* all tasks */
+};
+
+/* proc fs registry */
+#define SIM_MAX_PROC 8
+
+struct proc_dir_entry {
+	char name[64];
+	const struct file_operations *fops;
+	int used;
+};
+
+/* workqueue: one worker task */
+struct workqueue_struct {
+	char name[32];
+	struct task_struct *worker;
+	wait_queue_head_t wait; /* the worker waits here for work to fall due */
+	struct delayed_work *pending; /* by due time, FIFO among equals */
+	struct delayed_work *running; /* the item the worker is in */
+	wait_queue_head_t idle; /* woken as each item returns */
+};
+
+/* misc device registry */
+#define SIM_MAX_DEV 4
+
+/* an open misc device */
+struct sim_dev {
+	struct file file;
+	const struct file_operations *fops;
+};
+
+/* module parameter registry */
+#define SIM_MAX_PARAMS 32
+
+struct sim_param {
+	const char *name;
+	void *value;
+	enum sim_param_type type;
+	const struct kernel_param_ops *ops; /* SIM_PARAM_CB only */
+};
+
+/* syscall stubs normally exported by the patched kernel */
+long (*STUB_start_elevator)(void);
+long (*STUB_issue_request)(int, int, int);
+long (*STUB_stop_elevator)(void);
+long (*STUB_issue_request_batch)(struct elevator_request __user *, int);
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct task_struct main_task;
+static struct task_struct *tasks;
+static struct task_struct *current_task;
+static u64 sim_now; /* virtual clock in ns */
+static int sim_verbose;
+static struct proc_dir_entry proc_entries[SIM_MAX_PROC];
+static struct miscdevice *devices[SIM_MAX_DEV];
+static struct sim_param params[SIM_MAX_PARAMS];
+static int num_params;
+
+/* Scheduler (all called with sim_lock held) */
+
+/* round-robin over runnable tasks, starting after the current one */
+static struct task_struct *find_runnable(void) {
+	struct task_struct *t;
+
+	t = current_task;
+	do {
+		t = t->next ? t->next : tasks;
+		if (t->state == TASK_RUNNABLE) {
+			return t;
+		}
+	} while (t != current_task);
+	return NULL;
+}
+
+/* take a blocked task off its wait queue and make it runnable */
+static void unblock_locked(struct task_struct *task) {
+	struct task_struct **pos;
+
+	for (pos = &task->wq->head; *pos != NULL; pos = &(*pos)->wq_next) {
+		if (*pos == task) {
+			*pos = task->wq_next;
+			break;
+		}
+	}
+	task->wq_next = NULL;
+	task->wq = NULL;
+	task->timed = 0;
+	task->state = TASK_RUNNABLE;
+}
+
+static int has_deadline(struct task_struct *t) {
+	return t->state == TASK_SLEEPING || (t->state == TASK_BLOCKED && t->timed);
+}
+
+/* advance the clock to the earliest deadline and wake everyone due by 
+then: sleepers, and waiters whose timeout expired */
+static int advance_clock(void) {
+	struct task_struct *t;
+	int found;
+	u64 earliest;
+
+	found = 0;
+	earliest = 0;
+	for (t = tasks; t != NULL; t = t->next) {
+		if (has_deadline(t) && (!found || t->wake_at < earliest)) {
+			earliest = t->wake_at;
+			found = 1;
+		}
+	}
+	if (!found) {
+		return 0;
+	}
+
+	if (earliest > sim_now) {
+		sim_now = earliest;
+	}
+	for (t = tasks; t != NULL; t = t->next) {
+		if (has_deadline(t) && t->wake_at <= sim_now) {
+			if (t->state == TASK_BLOCKED) {
+				unblock_locked(t);
+			}
+			t->state = TASK_RUNNABLE;
+		}
+	}
+	return 1;
+}
+
+/* hand the cpu to the next task and wait until it comes back */
+static void sim_switch(void) {
+	struct task_struct *self, *next;
+
+	self = current_task;
+	next = find_runnable();
+	while (next == NULL) {
+		if (!advance_clock()) {
+			fprintf(stderr, "sim: deadlock, every task is blocked\n");
+			abort();
+		}
+		next = find_runnable();
+	}
+
+	current_task = next;
+	if (next == self) {
+		return;
+	}
+	pthread_cond_signal(&next->cond);
+	if (self->state == TASK_DONE) {
+		return; /* the exiting thread never runs again */
+	}
+	while (current_task != self) {
+		pthread_cond_wait(&self->cond, &sim_lock);
+	}
+}
+
+static void wake_all_locked(wait_queue_head_t *wq) {
+	struct task_struct *t, *next;
+
+	for (t = wq->head; t != NULL; t = next) {
+		next = t->wq_next;
+		t->wq_next = NULL;
+		t->wq = NULL;
+		t->timed = 0;
+		t->state = TASK_RUNNABLE;
+	}
+	wq->head = NULL;
+}
+
+static void wait_on_locked(wait_queue_head_t *wq) {
+	struct task_struct **pos;
+
+	/* append, so waiters are woken in FIFO order */
+	for (pos = &wq->head; *pos != NULL; pos = &(*pos)->wq_next)
+		;
+	*pos = current_task;
+	current_task->wq_next = NULL;
+	current_task->wq = wq;
+	current_task->state = TASK_BLOCKED;
+	sim_switch();
+}
+
+static void sleep_until_locked(u64 when) {
+	current_task->wake_at = when;
+	current_task->state = TASK_SLEEPING;
+	sim_switch();
+}
+
+/* Kernel interfaces */
+
+int printk(const char *fmt, ...) {
+	va_list ap;
+	int n;
+
+	if (!sim_verbose) {
+		return 0;
+	}
+	va_start(ap, fmt);
+	fprintf(stderr, "[%10.3f] ", sim_now / 1e9);
+	n = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+int sim_tracing;
+
+void sim_trace(const char *event, const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	printf("%16s %10.3f: %s: ", current_task->name, sim_now / 1e9, event);
+	vprintf(fmt, ap);
+	putchar('\n');
+	va_end(ap);
+}
+
+const char *sim_print_symbolic(unsigned long value, 
+const struct trace_print_flags *symbols) {
+	for (; symbols->name != NULL; ++symbols) {
+		if (symbols->mask == value) {
+			return symbols->name;
+		}
+	}
+	return "?";
+}
+
+void msleep(unsigned int msecs) {
+	pthread_mutex_lock(&sim_lock);
+	sleep_until_locked(sim_now + (u64)msecs * 1000000ULL);
+	pthread_mutex_unlock(&sim_lock);
+}
+
+void sim_wait_on(wait_queue_head_t *wq) {
+	pthread_mutex_lock(&sim_lock);
+	wait_on_locked(wq);
+	pthread_mutex_unlock(&sim_lock);
+}
+
+long sim_wait_on_timeout(wait_queue_head_t *wq, long ms) {
+	u64 end;
+	long left;
+
+	pthread_mutex_lock(&sim_lock);
+	end = sim_now + (u64)ms * 1000000ULL;
+	current_task->wake_at = end;
+	current_task->timed = 1;
+	wait_on_locked(wq);
+	left = sim_now < end ? (end - sim_now + 999999) / 1000000 : 0;
+	pthread_mutex_unlock(&sim_lock);
+	return left;
+}
+
+void sim_wake_all(wait_queue_head_t *wq) {
+	pthread_mutex_lock(&sim_lock);
+	wake_all_locked(wq);
+	pthread_mutex_unlock(&sim_lock);
+}
+
+int wake_up_process(struct task_struct *task) {
+	int woken;
+
+	woken = 0;
+	pthread_mutex_lock(&sim_lock);
+	/* like the kernel, msleep() goes back to sleep until its timeout */
+	if (task->state == TASK_BLOCKED) {
+		unblock_locked(task);
+		woken = 1;
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return woken;
+}
+
+static void *task_main(void *arg) {
+	struct task_struct *t;
+	int ret;
+
+	t = arg;
+	pthread_mutex_lock(&sim_lock);
+	while (current_task != t) {
+		pthread_cond_wait(&t->cond, &sim_lock);
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	ret = t->fn(t->data);
+
+	pthread_mutex_lock(&sim_lock);
+	t->ret = ret;
+	t->state = TASK_DONE;
+	wake_all_locked(&t->exited);
+	sim_switch();
+	pthread_mutex_unlock(&sim_lock);
+	return NULL;
+}
+
+struct task_struct *sim_kthread_run(int (*fn)(void *), void *data,
+const char *namefmt, ...) {
+	struct task_struct *t, **pos;
+	va_list ap;
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL) {
+		return ERR_PTR(-ENOMEM);
+	}
+	va_start(ap, namefmt);
+	vsnprintf(t->name, sizeof(t->name), namefmt, ap);
+	va_end(ap);
+	t->fn = fn;
+	t->data = data;
+	t->state = TASK_RUNNABLE;
+	init_waitqueue_head(&t->exited);
+	pthread_cond_init(&t->cond, NULL);
+
+	pthread_mutex_lock(&sim_lock);
+	for (pos = &tasks; *pos != NULL; pos = &(*pos)->next)
+		;
+	*pos = t;
+	if (pthread_create(&t->thread, NULL, task_main, t) != 0) {
+		*pos = NULL;
+		pthread_mutex_unlock(&sim_lock);
+		pthread_cond_destroy(&t->cond);
+		free(t);
+		return ERR_PTR(-EAGAIN);
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return t;
+}
+
+int kthread_should_stop(void) {
+	return current_task->should_stop;
+}
+
+int kthread_stop(struct task_struct *task) {
+	struct task_struct **pos;
+	int ret;
+
+	task->should_stop = 1;
+	wake_up_process(task);
+
+	pthread_mutex_lock(&sim_lock);
+	while (task->state != TASK_DONE) {
+		wait_on_locked(&task->exited);
+	}
+	ret = task->ret;
+	for (pos = &tasks; *pos != task; pos = &(*pos)->next)
+		;
+	*pos = task->next;
+	pthread_mutex_unlock(&sim_lock);
+
+	pthread_join(task->thread, NULL);
+	pthread_cond_destroy(&task->cond);
+	free(task);
+	return ret;
+}
+
+struct proc_dir_entry *proc_create(const char *name, unsigned short mode,
+struct proc_dir_entry *parent, const struct file_operations *fops) {
+	int i;
+
+	(void)mode;
+	(void)parent;
+	for (i = 0; i < SIM_MAX_PROC; ++i) {
+		if (!proc_entries[i].used) {
+			snprintf(proc_entries[i].name, sizeof(proc_entries[i].name),
+				"%s", name);
+			proc_entries[i].fops = fops;
+			proc_entries[i].used = 1;
+			return &proc_entries[i];
+		}
+	}
+	return NULL;
+}
+
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent) {
+	int i;
+
+	(void)parent;
+	for (i = 0; i < SIM_MAX_PROC; ++i) {
+		if (proc_entries[i].used && strcmp(proc_entries[i].name, name) == 0) {
+			proc_entries[i].used = 0;
+		}
+	}
+}
+
+/* workqueues */
+
+/* take dwork off its workqueue (sim_lock held) */
+static void unqueue_work_locked(struct delayed_work *dwork) {
+	struct delayed_work **pos;
+
+	for (pos = &dwork->wq->pending; *pos != NULL; pos = &(*pos)->next) {
+		if (*pos == dwork) {
+			*pos = dwork->next;
+			break;
+		}
+	}
+	dwork->next = NULL;
+	dwork->pending = 0;
+}
+
+/* queue dwork to run delay jiffies (ms) from now (sim_lock held) */
+static void queue_work_locked(struct workqueue_struct *wq, 
+struct delayed_work *dwork, unsigned long delay) {
+	struct delayed_work **pos;
+
+	dwork->wq = wq;
+	dwork->due = sim_now + (u64)delay * 1000000ULL;
+	dwork->pending = 1;
+	for (pos = &wq->pending; *pos != NULL && (*pos)->due <= dwork->due; 
+			pos = &(*pos)->next)
+		;
+	dwork->next = *pos;
+	*pos = dwork;
+	wake_all_locked(&wq->wait);
+}
+
+static int worker_main(void *data) {
+	struct workqueue_struct *wq;
+	struct delayed_work *dwork;
+	u64 due;
+
+	wq = data;
+	/* destroy_workqueue() drains whatever is still queued */
+	while (!kthread_should_stop() || wq->pending != NULL) {
+		pthread_mutex_lock(&sim_lock);
+		dwork = wq->pending;
+		if (dwork == NULL) {
+			pthread_mutex_unlock(&sim_lock);
+			sim_wait_on(&wq->wait);
+			continue;
+		}
+		due = dwork->due;
+		if (due > sim_now) {
+			pthread_mutex_unlock(&sim_lock);
+			sim_wait_on_timeout(&wq->wait, (due - sim_now + 999999) / 1000000);
+			continue;
+		}
+		unqueue_work_locked(dwork);
+		wq->running = dwork;
+		pthread_mutex_unlock(&sim_lock);
+		dwork->work.func(&dwork->work);
+		pthread_mutex_lock(&sim_lock);
+		wq->running = NULL;
+		wake_all_locked(&wq->idle);
+		pthread_mutex_unlock(&sim_lock);
+	}
+	return 0;
+}
+
+struct workqueue_struct *alloc_workqueue(const char *name, unsigned int flags, 
+int max_active) {
+	struct workqueue_struct *wq;
+
+	(void)flags;
+	(void)max_active;
+	wq = calloc(1, sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	snprintf(wq->name, sizeof(wq->name), "%s", name);
+	init_waitqueue_head(&wq->wait);
+	init_waitqueue_head(&wq->idle);
+	wq->worker = sim_kthread_run(worker_main, wq, "%s", name);
+	if (IS_ERR(wq->worker)) {
+		free(wq);
+		return NULL;
+	}
+	return wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq) {
+	kthread_stop(wq->worker);
+	free(wq);
+}
+
+bool queue_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, 
+unsigned long delay) {
+	bool queued;
+
+	pthread_mutex_lock(&sim_lock);
+	queued = !dwork->pending;
+	if (queued) {
+		queue_work_locked(wq, dwork, delay);
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return queued;
+}
+
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, 
+unsigned long delay) {
+	bool was_pending;
+
+	pthread_mutex_lock(&sim_lock);
+	was_pending = dwork->pending;
+	if (was_pending) {
+		unqueue_work_locked(dwork);
+	}
+	queue_work_locked(wq, dwork, delay);
+	pthread_mutex_unlock(&sim_lock);
+	return was_pending;
+}
+
+/* run dwork now if it is pending and wait until it has returned */
+bool flush_delayed_work(struct delayed_work *dwork) {
+	struct workqueue_struct *wq;
+	bool busy;
+
+	pthread_mutex_lock(&sim_lock);
+	wq = dwork->wq;
+	busy = wq != NULL && (dwork->pending || wq->running == dwork);
+	if (busy && dwork->pending) {
+		unqueue_work_locked(dwork);
+		queue_work_locked(wq, dwork, 0);
+	}
+	while (wq != NULL && (dwork->pending || wq->running == dwork)) {
+		pthread_mutex_unlock(&sim_lock);
+		sim_wait_on(&wq->idle);
+		pthread_mutex_lock(&sim_lock);
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return busy;
+}
+
+struct workqueue_struct *sim_system_wq(void) {
+	static struct workqueue_struct *events;
+
+	if (events == NULL) {
+		events = alloc_workqueue("events", 0, 0);
+	}
+	return events;
+}
+
+/* misc devices */
+
+int misc_register(struct miscdevice *misc) {
+	int i;
+
+	for (i = 0; i < SIM_MAX_DEV; ++i) {
+		if (devices[i] == NULL) {
+			devices[i] = misc;
+			return 0;
+		}
+	}
+	return -EBUSY;
+}
+
+void misc_deregister(struct miscdevice *misc) {
+	int i;
+
+	for (i = 0; i < SIM_MAX_DEV; ++i) {
+		if (devices[i] == misc) {
+			devices[i] = NULL;
+		}
+	}
+}
+
+loff_t noop_llseek(struct file *file, loff_t offset, int whence) {
+	return file->f_pos;
+}
+
+/* pages and mmap */
+
+void *alloc_pages_exact(size_t size, gfp_t flags) {
+	void *p;
+
+	p = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+	if (p != NULL && (flags & __GFP_ZERO)) {
+		memset(p, 0, PAGE_ALIGN(size));
+	}
+	return p;
+}
+
+void free_pages_exact(void *virt, size_t size) {
+	free(virt);
+}
+
+int vm_insert_page(struct vm_area_struct *vma, unsigned long addr, 
+struct page *page) {
+	if (addr == vma->vm_start) {
+		vma->sim_mapping = page;
+	}
+	return 0;
+}
+
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+const void *from, size_t available) {
+	loff_t pos;
+
+	pos = *ppos;
+	if (pos < 0) {
+		return -EINVAL;
+	}
+	if ((size_t)pos >= available || count == 0) {
+		return 0;
+	}
+	if (count > available - pos) {
+		count = available - pos;
+	}
+	memcpy(to, (const char *)from + pos, count);
+	*ppos = pos + count;
+	return count;
+}
+
+/* seq_file */
+
+int seq_open(struct file *file, const struct seq_operations *op) {
+	struct seq_file *m;
+
+	m = calloc(1, sizeof(*m));
+	if (m == NULL) {
+		return -ENOMEM;
+	}
+	m->op = op;
+	file->private_data = m;
+	return 0;
+}
+
+/* generate the next record into m->buf, growing the buffer until it fits; 
+returns 0 at the end of the sequence */
+static int seq_fill(struct seq_file *m) {
+	void *p;
+	int more;
+
+	if (m->buf == NULL) {
+		m->size = 4096;
+		m->buf = malloc(m->size);
+		if (m->buf == NULL) {
+			return -ENOMEM;
+		}
+	}
+	for (;;) {
+		m->from = 0;
+		m->count = 0;
+		p = m->op->start(m, &m->index);
+		more = p != NULL && !IS_ERR(p);
+		if (more) {
+			m->op->show(m, p);
+		}
+		if (!more || m->count < m->size) {
+			if (more) {
+				p = m->op->next(m, p, &m->index);
+			}
+			m->op->stop(m, p);
+			return more;
+		}
+		/* overflow: retry the record with a bigger buffer */
+		m->op->stop(m, p);
+		free(m->buf);
+		m->size *= 2;
+		m->buf = malloc(m->size);
+		if (m->buf == NULL) {
+			return -ENOMEM;
+		}
+	}
+}
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t size, loff_t *ppos) {
+	struct seq_file *m;
+	size_t copied, n;
+	int err;
+
+	m = file->private_data;
+	copied = 0;
+	while (copied < size) {
+		if (m->count == 0) {
+			err = seq_fill(m);
+			if (err < 0) {
+				return copied > 0 ? (ssize_t)copied : err;
+			}
+			if (err == 0) {
+				break;
+			}
+		}
+		n = min(m->count, size - copied);
+		memcpy(buf + copied, m->buf + m->from, n);
+		m->from += n;
+		m->count -= n;
+		copied += n;
+	}
+	*ppos += copied;
+	return copied;
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence) {
+	return -ESPIPE;
+}
+
+int seq_release(struct inode *inode, struct file *file) {
+	struct seq_file *m;
+
+	m = file->private_data;
+	free(m->buf);
+	free(m);
+	return 0;
+}
+
+/* single_open: one record produced by show */
+struct single_seq {
+	struct seq_operations op;
+	int (*show)(struct seq_file *, void *);
+};
+
+static void *single_start(struct seq_file *m, loff_t *pos) {
+	return *pos == 0 ? SEQ_START_TOKEN : NULL;
+}
+
+static void *single_next(struct seq_file *m, void *v, loff_t *pos) {
+	*pos += 1;
+	return NULL;
+}
+
+static void single_stop(struct seq_file *m, void *v) {
+}
+
+static int single_show(struct seq_file *m, void *v) {
+	return ((const struct single_seq *)m->op)->show(m, v);
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *), 
+void *data) {
+	struct single_seq *ss;
+	int err;
+
+	ss = calloc(1, sizeof(*ss));
+	if (ss == NULL) {
+		return -ENOMEM;
+	}
+	ss->op.start = single_start;
+	ss->op.next = single_next;
+	ss->op.stop = single_stop;
+	ss->op.show = single_show;
+	ss->show = show;
+	err = seq_open(file, &ss->op);
+	if (err != 0) {
+		free(ss);
+		return err;
+	}
+	((struct seq_file *)file->private_data)->private = data;
+	return 0;
+}
+
+int single_release(struct inode *inode, struct file *file) {
+	const struct seq_operations *op;
+
+	op = ((struct seq_file *)file->private_data)->op;
+	seq_release(inode, file);
+	free((void *)op);
+	return 0;
+}
+
+void seq_printf(struct seq_file *m, const char *fmt, ...) {
+	va_list args;
+	int n;
+
+	if (m->count >= m->size) {
+		return;
+	}
+	va_start(args, fmt);
+	n = vsnprintf(m->buf + m->count, m->size - m->count, fmt, args);
+	va_end(args);
+	/* on overflow, mark the buffer full so the record is retried */
+	m->count = m->count + n < m->size ? m->count + n : m->size;
+}
+
+void seq_putc(struct seq_file *m, char c) {
+	if (m->count < m->size) {
+		m->buf[m->count++] = c;
+	}
+}
+
+void seq_puts(struct seq_file *m, const char *s) {
+	seq_printf(m, "%s", s);
+}
+
+void sim_register_param(const char *name, void *value, enum sim_param_type type) {
+	if (num_params == SIM_MAX_PARAMS) {
+		fprintf(stderr, "sim: too many module parameters\n");
+		abort();
+	}
+	params[num_params].name = name;
+	params[num_params].value = value;
+	params[num_params].type = type;
+	num_params += 1;
+}
+
+void sim_register_param_cb(const char *name, 
+const struct kernel_param_ops *ops, void *arg) {
+	sim_register_param(name, arg, SIM_PARAM_CB);
+	params[num_params - 1].ops = ops;
+}
+
+/* Driver interface */
+
+int sim_set_param(const char *name, const char *value) {
+	struct kernel_param kp;
+	int i;
+
+	for (i = 0; i < num_params; ++i) {
+		if (strcmp(params[i].name, name) != 0) {
+			continue;
+		}
+		switch (params[i].type) {
+		case SIM_PARAM_INT:
+			*(int *)params[i].value = strtol(value, NULL, 0);
+			break;
+		case SIM_PARAM_UINT:
+			*(unsigned int *)params[i].value = strtoul(value, NULL, 0);
+			break;
+		case SIM_PARAM_BOOL:
+			*(_Bool *)params[i].value = strcmp(value, "0") != 0 && 
+				strcmp(value, "N") != 0 && strcmp(value, "n") != 0;
+			break;
+		case SIM_PARAM_CB:
+			kp.name = params[i].name;
+			kp.ops = params[i].ops;
+			kp.arg = params[i].value;
+			return kp.ops->set(value, &kp);
+		}
+		return 0;
+	}
+	return -1;
+}
+
+void sim_init(void) {
+	snprintf(main_task.name, sizeof(main_task.name), "userspace");
+	main_task.state = TASK_RUNNABLE;
+	init_waitqueue_head(&main_task.exited);
+	pthread_cond_init(&main_task.cond, NULL);
+	tasks = &main_task;
+	current_task = &main_task;
+	sim_now = 0;
+}
+
+ktime_t ktime_get(void) {
+	return sim_now;
+}
+
+unsigned long long sim_now_ms(void) {
+	return sim_now / 1000000ULL;
+}
+
+void sim_sleep_until_ms(unsigned long long when) {
+	pthread_mutex_lock(&sim_lock);
+	if (when * 1000000ULL > sim_now) {
+		sleep_until_locked(when * 1000000ULL);
+	}
+	pthread_mutex_unlock(&sim_lock);
+}
+
+void sim_set_verbose(int verbose) {
+	sim_verbose = verbose;
+}
+
+void sim_set_tracing(int tracing) {
+	sim_tracing = tracing;
+}
+
+long sim_proc_read(const char *name, char *buf, unsigned long size) {
+	const struct file_operations *fops;
+	struct file file;
+	unsigned long len;
+	ssize_t n;
+	int i;
+
+	fops = NULL;
+	for (i = 0; i < SIM_MAX_PROC; ++i) {
+		if (proc_entries[i].used && strcmp(proc_entries[i].name, name) == 0) {
+			fops = proc_entries[i].fops;
+		}
+	}
+	if (fops == NULL || fops->read == NULL || size == 0) {
+		return -1;
+	}
+
+	memset(&file, 0, sizeof(file));
+	if (fops->open && fops->open(NULL, &file) != 0) {
+		return -1;
+	}
+	/* read until EOF, leaving room for the terminator */
+	len = 0;
+	while (len < size - 1) {
+		n = fops->read(&file, buf + len, size - 1 - len, &file.f_pos);
+		if (n <= 0) {
+			break;
+		}
+		len += n;
+	}
+	buf[len] = '\0';
+	if (fops->release) {
+		fops->release(NULL, &file);
+	}
+	return len;
+}
+
+const void *sim_proc_mmap(const char *name, unsigned long size) {
+	const struct file_operations *fops;
+	struct vm_area_struct vma;
+	struct file file;
+	int i;
+
+	fops = NULL;
+	for (i = 0; i < SIM_MAX_PROC; ++i) {
+		if (proc_entries[i].used && strcmp(proc_entries[i].name, name) == 0) {
+			fops = proc_entries[i].fops;
+		}
+	}
+	if (fops == NULL || fops->mmap == NULL) {
+		return NULL;
+	}
+
+	memset(&file, 0, sizeof(file));
+	memset(&vma, 0, sizeof(vma));
+	vma.vm_end = size;
+	vma.vm_flags = VM_MAYWRITE;
+	if (fops->mmap(&file, &vma) != 0) {
+		return NULL;
+	}
+	return vma.sim_mapping;
+}
+
+struct sim_dev *sim_dev_open(const char *name, int nonblock) {
+	const struct file_operations *fops;
+	struct sim_dev *dev;
+	int i;
+
+	fops = NULL;
+	for (i = 0; i < SIM_MAX_DEV; ++i) {
+		if (devices[i] != NULL && strcmp(devices[i]->name, name) == 0) {
+			fops = devices[i]->fops;
+		}
+	}
+	if (fops == NULL) {
+		return NULL;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	if (dev == NULL) {
+		return NULL;
+	}
+	dev->fops = fops;
+	dev->file.f_flags = nonblock ? O_NONBLOCK : 0;
+	if (fops->open && fops->open(NULL, &dev->file) != 0) {
+		free(dev);
+		return NULL;
+	}
+	return dev;
+}
+
+long sim_dev_read(struct sim_dev *dev, void *buf, unsigned long size) {
+	if (dev->fops->read == NULL) {
+		return -EINVAL;
+	}
+	return dev->fops->read(&dev->file, buf, size, &dev->file.f_pos);
+}
+
+long sim_dev_write(struct sim_dev *dev, const void *buf, unsigned long size) {
+	if (dev->fops->write == NULL) {
+		return -EINVAL;
+	}
+	return dev->fops->write(&dev->file, buf, size, &dev->file.f_pos);
+}
+
+long sim_dev_ioctl(struct sim_dev *dev, unsigned int cmd, void *arg) {
+	if (dev->fops->unlocked_ioctl == NULL) {
+		return -ENOTTY;
+	}
+	return dev->fops->unlocked_ioctl(&dev->file, cmd, (unsigned long)arg);
+}
+
+unsigned int sim_dev_poll(struct sim_dev *dev) {
+	if (dev->fops->poll == NULL) {
+		return EPOLLIN;
+	}
+	return dev->fops->poll(&dev->file, NULL);
+}
+
+void sim_dev_close(struct sim_dev *dev) {
+	if (dev->fops->release) {
+		dev->fops->release(NULL, &dev->file);
+	}
+	free(dev);
+}
@@ -0,0 +1,59 @@
+#ifndef __SIM_H
+#define __SIM_H
+
+#include "../elevator_uapi.h"
+
+/*
+ * Driver-side interface of the userspace elevator simulator.
+ *
+ * libelevator.a contains elevator.c built against the kernel shim plus the
+ * discrete-event runtime. The calling thread becomes the first simulated
+ * task ("userspace"); kthreads spawned by the module run as further tasks
+ * on the same virtual clock.
+ */
+
+/* runtime */
+void sim_init(void);
+unsigned long long sim_now_ms(void);
+void sim_sleep_until_ms(unsigned long long when);
+void sim_set_verbose(int verbose);
+/* print the module's tracepoints to stdout as they fire */
+void sim_set_tracing(int tracing);
+
+/* set a module parameter by name, as insmod would before 
+sim_module_init() or as a write to /sys/module/elevator/parameters would 
+afterwards; returns -1 if the module has no such parameter, or the 
+parameter's own error (e.g. -EINVAL) */
+int sim_set_param(const char *name, const char *value);
+
+/* module entry points, as the kernel would call them */
+int sim_module_init(void);
+void sim_module_exit(void);
+
+/* system calls implemented by the module */
+long my_start_elevator(void);
+long my_issue_request(int, int, int);
+long my_stop_elevator(void);
+long my_issue_request_batch(struct elevator_request *, int);
+
+/* read a whole /proc file into buf; returns the length or -1 */
+long sim_proc_read(const char *name, char *buf, unsigned long size);
+
+/* mmap the first size bytes of a /proc file read-only; returns NULL if 
+the file cannot be mapped. The mapping stays valid until module exit. */
+const void *sim_proc_mmap(const char *name, unsigned long size);
+
+/* open the misc device /dev/name; returns NULL if there is none. Reads 
+block the calling task on the virtual clock unless nonblock is set, in 
+which case they return -EAGAIN. Errors are negative errnos, as the 
+module returns them. sim_dev_poll() returns the poll mask (POLLIN is 1). 
+Close devices before sim_module_exit(). */
+struct sim_dev;
+struct sim_dev *sim_dev_open(const char *name, int nonblock);
+long sim_dev_read(struct sim_dev *dev, void *buf, unsigned long size);
+long sim_dev_write(struct sim_dev *dev, const void *buf, unsigned long size);
+long sim_dev_ioctl(struct sim_dev *dev, unsigned int cmd, void *arg);
+unsigned int sim_dev_poll(struct sim_dev *dev);
+void sim_dev_close(struct sim_dev *dev);
+
+#endif
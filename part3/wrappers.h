@@ -2,23 +2,125 @@
 #define __WRAPPERS_H
 
 #define _GNU_SOURCE
+#include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
 #include <sys/syscall.h>
+#include "elevator_uapi.h"
 
 #define __NR_START_ELEVATOR 335
 #define __NR_STOP_ELEVATOR 336
 #define __NR_ISSUE_REQUEST 337
+#define __NR_ISSUE_REQUEST_BATCH 338
 
+#define ELEVATOR_DEV "/dev/elevator"
+
+/* The wrappers use /dev/elevator when the module provides it, and the 
+system calls of the patched kernel otherwise; results are the same 
+either way. Each thread opens its own descriptor, which only receives 
+the outcome of its own writes. */
+__thread int elevator_fd = -2; /* -2 not opened yet, -1 no device */
+
+int elevator_dev() {
+	unsigned int mask = 1u << ELEVATOR_EVENT_REQUEST;
+
+	if (elevator_fd == -2) {
+		elevator_fd = open(ELEVATOR_DEV, O_RDWR);
+		if (elevator_fd >= 0 && ioctl(elevator_fd, ELEVATOR_IOC_EVENTS, &mask) != 0) {
+			close(elevator_fd);
+			elevator_fd = -1;
+		}
+	}
+	return elevator_fd;
+}
+
+/* write the requests to the device and read back their outcome; returns 
+the number queued, or -1 */
+int elevator_dev_submit(int fd, struct elevator_request *reqs, int count) {
+	struct elevator_event ev[64];
+	int done, queued, i;
+	ssize_t n;
+
+	if (write(fd, reqs, count * sizeof(*reqs)) != (ssize_t)(count * sizeof(*reqs)))
+		return -1;
+	done = 0;
+	queued = 0;
+	while (done < count) {
+		n = read(fd, ev, sizeof(ev));
+		if (n <= 0)
+			return -1;
+		for (i = 0; i < n / (ssize_t)sizeof(ev[0]); ++i) {
+			if (ev[i].kind != ELEVATOR_EVENT_REQUEST || ev[i].index >= (unsigned int)count)
+				continue;
+			reqs[ev[i].index].status = ev[i].status;
+			reqs[ev[i].index].id = ev[i].id;
+			queued += ev[i].status == 0;
+			done += 1;
+		}
+	}
+	return queued;
+}
+
+/* returns 0 if started, 1 if it was already running */
 int start_elevator() {
-	return syscall(__NR_START_ELEVATOR);
+	if (elevator_dev() < 0)
+		return syscall(__NR_START_ELEVATOR);
+	if (ioctl(elevator_fd, ELEVATOR_IOC_START) == 0)
+		return 0;
+	return errno == EBUSY ? 1 : -1;
 }
 
+/* returns 0 if queued, 1 if rejected, or -1 with errno set */
 int issue_request(int start, int dest, int type) {
-	return syscall(__NR_ISSUE_REQUEST, start, dest, type);
+	struct elevator_request req = { start, dest, type, 0, 0 };
+
+	if (elevator_dev() < 0)
+		return syscall(__NR_ISSUE_REQUEST, start, dest, type);
+	if (elevator_dev_submit(elevator_fd, &req, 1) < 0)
+		return -1;
+	if (req.status < 0) {
+		errno = -req.status;
+		return -1;
+	}
+	return req.status;
+}
+
+/* returns the number of queued requests; per-entry results are in status */
+int issue_request_batch(struct elevator_request *reqs, int count) {
+	if (elevator_dev() < 0)
+		return syscall(__NR_ISSUE_REQUEST_BATCH, reqs, count);
+	if (count <= 0 || count > ELEVATOR_BATCH_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	return elevator_dev_submit(elevator_fd, reqs, count);
 }
 
+/* returns 0 if stopping, 1 if it was already stopped */
 int stop_elevator() {
-	return syscall(__NR_STOP_ELEVATOR);
+	if (elevator_dev() < 0)
+		return syscall(__NR_STOP_ELEVATOR);
+	if (ioctl(elevator_fd, ELEVATOR_IOC_STOP) == 0)
+		return 0;
+	return errno == EALREADY ? 1 : -1;
+}
+
+/* an integer parameter of the loaded module, or fallback */
+int elevator_param(const char *name, int fallback) {
+	char path[128];
+	FILE *f;
+	int value;
+
+	snprintf(path, sizeof(path), "/sys/module/elevator/parameters/%s", name);
+	f = fopen(path, "r");
+	if(f == NULL)
+		return fallback;
+	if(fscanf(f, "%d", &value) != 1)
+		value = fallback;
+	fclose(f);
+	return value;
 }
 
 #endif